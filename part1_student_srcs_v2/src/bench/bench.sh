@@ -0,0 +1,190 @@
+#!/bin/bash
+#
+# File: bench.sh
+#
+# Benchmark and regression harness for the cache simulators. Runs a fixed
+# set of traces through each model, records the host runtime, the accesses
+# per second and the complete statistics output, and compares them with
+# the baselines in bench/baseline. A run fails when the simulator does not
+# exit normally, when the output differs from its baseline (result drift)
+# or when it is more than the threshold slower. A run without a baseline
+# only gets a warning.
+#
+# The .out baselines are deterministic and belong in the repository; none
+# are committed yet, record them with --update from a -DNDEBUG build. The
+# .time baselines depend on the host and stay out of it, so a run is only
+# checked for slowdowns once --update has recorded them on this host.
+#
+# The simulators are taken from the environment, models without a binary
+# are skipped:
+#
+#     TASK1, TASK2    task_1 and task_2, run on every aca2009 trace file in
+#                     $ACA_TRACES (the course traces are not in the repo)
+#     TASK3           task_3, run on the generated traces and the ones in
+#                     bench/traces, in each configuration of TASK3_CONFIGS
+#
+# Build the simulators with -DNDEBUG, or the per-access trace ends up in
+# the output and dominates the runtime.
+#
+# Usage: bench.sh [--update] [--threshold <percent>] [--runs <n>]
+#
+#     --update        store the results as the new baselines
+#     --threshold     allowed slowdown against the baseline, default 10
+#     --runs          runs per trace, the fastest counts, default 3
+#
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+BASELINE=$BENCH_DIR/baseline
+OUT=${BENCH_OUT:-$(mktemp -d)}
+
+# name:options of the task_3 configurations
+TASK3_CONFIGS=${TASK3_CONFIGS:-"moesi: mesi:--protocol=mesi dragon:--protocol=dragon crossbar:--crossbar=4 directory:--directory=full ooo:--ooo=16"}
+
+# Accesses per CPU in the generated traces
+GEN_ENTRIES=${GEN_ENTRIES:-20000}
+
+update=0
+threshold=10
+runs=3
+failed=0
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --update)    update=1 ;;
+        --threshold) threshold=$2; shift ;;
+        --runs)      runs=$2; shift ;;
+        *)           echo "usage: $0 [--update] [--threshold <percent>] [--runs <n>]" >&2; exit 2 ;;
+    esac
+    shift
+done
+
+# gen <pattern> <cpus> <entries per cpu>: a stream trace (see
+# task_3/stream_trace.h) on stdout. The random numbers come from the
+# minimal standard generator, so every awk produces the same trace.
+gen() {
+    awk -v pattern="$1" -v cpus="$2" -v n="$3" '
+    function rnd(m) { seed = (seed * 16807) % 2147483647; return seed % m }
+    BEGIN {
+        seed = 42
+        for (i = 0; i < n; i++) {
+            for (c = 0; c < cpus; c++) {
+                if (pattern == "private") {
+                    # each CPU walks its own 16 KB, one write in four
+                    op = i % 4 == 3 ? "w" : "r"
+                    addr = c * 65536 + (i * 4) % 16384
+                } else if (pattern == "shared") {
+                    # all CPUs read a 32 KB table, few writes
+                    op = rnd(32) == 0 ? "w" : "r"
+                    addr = rnd(8192) * 4
+                } else if (pattern == "pingpong") {
+                    # CPUs take turns writing 8 shared lines
+                    op = (i + c) % 2 ? "w" : "r"
+                    addr = (int(i / 4) % 8) * 32
+                } else {
+                    # uniform over 256 KB, so mostly misses
+                    op = rnd(3) == 0 ? "w" : "r"
+                    addr = rnd(65536) * 4
+                }
+                printf "%d %s 0x%x\n", c, op, addr
+            }
+        }
+    }'
+}
+
+# Seconds since the epoch, with nanoseconds.
+now() {
+    date +%s.%N
+}
+
+# calc <expression>: evaluate a floating point expression, comparisons
+# give 1 or 0.
+calc() {
+    awk "BEGIN { print $1 }"
+}
+
+# bench <model> <name> <accesses> <command...>: run, compare and report.
+bench() {
+    local model=$1 name=$2 accesses=$3
+    shift 3
+
+    local out=$OUT/$model/$name.out best= t0 t1 t
+    mkdir -p "$OUT/$model"
+
+    for ((r = 0; r < runs; r++)); do
+        t0=$(now)
+        "$@" > "$out" 2>&1
+        local status=$?
+        if [ $status != 0 ]; then
+            printf "%-8s %-28s FAILED (exit status %d)\n" "$model" "$name" $status
+            failed=1
+            return
+        fi
+        t1=$(now)
+        t=$(calc "$t1 - $t0")
+        if [ -z "$best" ] || [ "$(calc "$t < $best")" = 1 ]; then best=$t; fi
+    done
+
+    local rate=-
+    if [ "$accesses" -gt 0 ]; then rate=$(calc "int($accesses / $best)"); fi
+
+    local base=$BASELINE/$model/$name result=ok
+    if [ $update = 1 ]; then
+        mkdir -p "$BASELINE/$model"
+        cp "$out" "$base.out"
+        echo "$best" > "$base.time"
+        result=updated
+    elif [ ! -f "$base.out" ]; then
+        result="no baseline (record it with --update)"
+        echo "warning: no baseline for $model/$name" >&2
+    elif ! diff -q "$base.out" "$out" > /dev/null; then
+        result="DRIFT (diff $base.out $out)"
+        failed=1
+    elif [ -f "$base.time" ] && [ "$(calc "$best > $(cat "$base.time") * (100 + $threshold) / 100")" = 1 ]; then
+        result="SLOW (baseline $(cat "$base.time") s)"
+        failed=1
+    fi
+
+    printf "%-8s %-28s %9.3f s %12s acc/s  %s\n" "$model" "$name" "$best" "$rate" "$result"
+}
+
+# Accesses in a stream trace, comments and blank lines excluded.
+accesses() {
+    grep -c '^[[:space:]]*[0-9]' "$1"
+}
+
+echo "Results in $OUT"
+
+for task in TASK1 TASK2; do
+    sim=${!task}
+    [ -n "$sim" ] || continue
+    if [ -z "$ACA_TRACES" ]; then
+        echo "$task: set ACA_TRACES to the directory of aca2009 trace files" >&2
+        continue
+    fi
+    for trace in "$ACA_TRACES"/*; do
+        bench "$(echo $task | tr A-Z a-z)" "$(basename "$trace")" 0 "$sim" "$trace"
+    done
+done
+
+if [ -n "$TASK3" ]; then
+    mkdir -p "$OUT/traces"
+    for pattern in private shared pingpong random; do
+        for cpus in 1 4 8; do
+            gen $pattern $cpus "$GEN_ENTRIES" > "$OUT/traces/$pattern.$cpus.trace"
+        done
+    done
+    cp "$BENCH_DIR"/traces/*.trace "$OUT/traces/"
+
+    for trace in "$OUT"/traces/*.trace; do
+        # <pattern>.<cpus>.trace
+        file=$(basename "$trace" .trace)
+        cpus=${file##*.}
+        n=$(accesses "$trace")
+        for config in $TASK3_CONFIGS; do
+            options=$(echo "${config#*:}" | tr = ' ')
+            bench task3 "$file.${config%%:*}" "$n" "$TASK3" $options --stream "$trace" "$cpus"
+        done
+    done
+fi
+
+exit $failed
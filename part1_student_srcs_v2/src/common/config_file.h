@@ -0,0 +1,120 @@
+/*
+// File: config_file.h
+//
+// Configuration files for the simulators. A configuration file holds
+// command line options, one per line and without the leading "--":
+//
+//     # 64 KB, 4-way
+//     cache-size = 65536
+//     associativity 4
+//     trace-window 1000 500
+//
+// The '=' is optional and '#' starts a comment. The options of the file
+// are inserted in front of the ones on the command line, so the simulator
+// parses them as usual and an option given on the command line overrides
+// the file.
+*/
+
+#ifndef CONFIG_FILE_H
+#define CONFIG_FILE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+class ConfigFile
+{
+public:
+    /* Take "--config <path>" out of argv and insert the options of the
+       file after argv[0]. Throws when the file cannot be read or has a
+       malformed line. */
+    void apply(int *argc, char ***argv)
+    {
+        char **args = *argv;
+        int i = 1;
+
+        while (i < *argc && strcmp(args[i], "--config") != 0) i++;
+        if (i >= *argc) return;
+        if (i + 1 >= *argc) throw std::runtime_error("--config needs a path");
+
+        read(args[i + 1]);
+
+        // argv itself cannot grow, the new one lives as long as we do
+        argv_storage.push_back(args[0]);
+        for (size_t w = 0; w < words.size(); w++) argv_storage.push_back(&words[w][0]);
+        for (int j = 1; j < *argc; j++)
+        {
+            if (j != i && j != i + 1) argv_storage.push_back(args[j]);
+        }
+        argv_storage.push_back(NULL);
+
+        *argc = argv_storage.size() - 1;
+        *argv = &argv_storage[0];
+    }
+
+    /* Where arg came from, "path:line", or NULL when not from the file. */
+    const char *origin(const char *arg) const
+    {
+        for (size_t w = 0; w < words.size(); w++)
+        {
+            if (arg == words[w].c_str()) return lines[w].c_str();
+        }
+        return NULL;
+    }
+
+private:
+    std::vector<std::string> words;     // the options of the file as arguments
+    std::vector<std::string> lines;     // origin of each word
+    std::vector<char *> argv_storage;
+
+    void read(const char *path)
+    {
+        std::ifstream in(path);
+        if (!in) throw std::runtime_error(std::string("cannot read config file ") + path);
+
+        std::string text;
+        for (int n = 1; std::getline(in, text); n++)
+        {
+            size_t hash = text.find('#');
+            if (hash != std::string::npos) text.erase(hash);
+
+            std::ostringstream where;
+            where << path << ":" << n;
+
+            std::istringstream line(text);
+            std::string name, word;
+            if (!(line >> name)) continue;
+
+            size_t eq = name.find('=');
+            std::string rest = eq == std::string::npos ? "" : name.substr(eq + 1);
+            name = name.substr(0, eq);
+            if (name.empty() || name.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789-") != std::string::npos)
+            {
+                throw std::runtime_error(where.str() + ": malformed option name");
+            }
+            add("--" + name, where.str());
+
+            if (!rest.empty()) add(rest, where.str());
+
+            bool first = eq == std::string::npos;     // may start with the '='
+            while (line >> word)
+            {
+                if (first && word[0] == '=') word.erase(0, 1);
+                first = false;
+                if (!word.empty()) add(word, where.str());
+            }
+        }
+    }
+
+    void add(const std::string &word, const std::string &where)
+    {
+        words.push_back(word);
+        lines.push_back(where);
+    }
+};
+
+#endif
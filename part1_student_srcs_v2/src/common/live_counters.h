@@ -0,0 +1,164 @@
+/*
+// File: live_counters.h
+//
+// Live counters in a POSIX shared memory segment, for watching a long run
+// from another process (see tools/live_view.cpp). The simulator copies the
+// scalar counters of a StatsExport into the segment every few thousand
+// cycles, so the access path is not touched at all. Every value is stored
+// with a relaxed atomic store and the segment is never locked: a reader
+// sees each counter whole, but the counters of one snapshot may come from
+// two consecutive updates.
+//
+// Segment layout, host byte order:
+//
+//     live_header_t
+//     char names[count][LIVE_NAME_SIZE]
+//     int64_t values[count]
+//
+// Link with -lrt on older C libraries.
+*/
+
+#ifndef LIVE_COUNTERS_H
+#define LIVE_COUNTERS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats_export.h"
+
+#define LIVE_MAGIC          "SIMLIVE1"
+#define LIVE_NAME_SIZE      64      // counter name including the '\0'
+
+typedef struct {
+    char magic[8];
+    uint32_t count;         // counters
+    uint32_t running;       // cleared when the simulation ends
+    uint64_t updates;       // incremented after every update
+    int64_t cycle;          // simulated cycles at the last update
+} live_header_t;
+
+class LiveCounters
+{
+public:
+    LiveCounters() : stats(NULL), header(NULL), size(0) {}
+
+    ~LiveCounters()
+    {
+        close();
+    }
+
+    /* Create the segment name ("/sim") for the counters of stats, which
+       must all be registered. Returns false when it cannot be created. */
+    bool open(const char *name, const StatsExport &stats)
+    {
+        int fd = shm_open(name, O_CREAT | O_TRUNC | O_RDWR, 0644);
+        if (fd < 0) return false;
+
+        size_t count = stats.size();
+        size = segment_size(count);
+        void *p = MAP_FAILED;
+        if (ftruncate(fd, size) == 0) p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+        {
+            shm_unlink(name);
+            return false;
+        }
+
+        header = (live_header_t *)p;
+        header->count = count;
+        header->running = 1;
+        for (size_t i = 0; i < count; i++)
+        {
+            strncpy(names(header) + i * LIVE_NAME_SIZE, stats.name(i).c_str(), LIVE_NAME_SIZE - 1);
+        }
+        memcpy(header->magic, LIVE_MAGIC, 8);
+
+        this->stats = &stats;
+        this->name = name;
+        return true;
+    }
+
+    /* Copy the counters at cycle into the segment. */
+    void update(long cycle)
+    {
+        if (header == NULL) return;
+
+        int64_t *v = values(header);
+        for (size_t i = 0; i < header->count; i++) __atomic_store_n(&v[i], stats->value(i), __ATOMIC_RELAXED);
+        __atomic_store_n(&header->cycle, cycle, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&header->updates, 1, __ATOMIC_RELEASE);
+    }
+
+    /* Publish the final values and remove the segment. Readers that are
+       attached keep their mapping. */
+    void close()
+    {
+        if (header == NULL) return;
+
+        __atomic_store_n(&header->running, 0, __ATOMIC_RELEASE);
+        munmap(header, size);
+        shm_unlink(name.c_str());
+        header = NULL;
+    }
+
+    /* Map the segment name read-only, NULL if there is none. */
+    static const live_header_t *attach(const char *name)
+    {
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0) return NULL;
+
+        struct stat st;
+        void *p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(live_header_t))
+        {
+            p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (p == MAP_FAILED) return NULL;
+
+        const live_header_t *h = (const live_header_t *)p;
+        if (memcmp(h->magic, LIVE_MAGIC, 8) != 0 || (size_t)st.st_size < segment_size(h->count))
+        {
+            munmap(p, st.st_size);
+            return NULL;
+        }
+        return h;
+    }
+
+    static size_t segment_size(size_t count)
+    {
+        return sizeof(live_header_t) + count * (LIVE_NAME_SIZE + sizeof(int64_t));
+    }
+
+    static const char *names(const live_header_t *h)
+    {
+        return (const char *)(h + 1);
+    }
+
+    static const int64_t *values(const live_header_t *h)
+    {
+        return (const int64_t *)(names(h) + h->count * LIVE_NAME_SIZE);
+    }
+
+private:
+    const StatsExport *stats;
+    live_header_t *header;
+    size_t size;
+    std::string name;
+
+    static char *names(live_header_t *h)
+    {
+        return (char *)(h + 1);
+    }
+
+    static int64_t *values(live_header_t *h)
+    {
+        return (int64_t *)(names(h) + h->count * LIVE_NAME_SIZE);
+    }
+};
+
+#endif
@@ -0,0 +1,171 @@
+/*
+// File: log.h
+//
+// Logging for the simulators. Text messages have a level, and messages
+// above LOG_LEVEL compile away: build with -DLOG_LEVEL=LOG_LEVEL_INFO (or
+// -DNDEBUG) to drop the per-access trace entirely. Lines end in '\n'
+// instead of endl, so the console is not flushed for every line.
+//
+// Events can also be recorded in binary as fixed-size records. Each thread
+// collects records in its own buffer, and the buffer is written to the
+// record file in blocks of LOG_BLOCK records. While no record file is open
+// a record costs one branch. Build with -DLOG_RECORDS=0 to compile
+// recording away.
+//
+// The record file starts with the 8 bytes "SIMLOG1\0", followed by
+// log_record_t records in host byte order.
+*/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <iostream>
+
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_INFO      1   // once per run
+#define LOG_LEVEL_TRACE     2   // every access, snoop and bus request
+
+#ifndef LOG_LEVEL
+#ifdef NDEBUG
+#define LOG_LEVEL           LOG_LEVEL_INFO
+#else
+#define LOG_LEVEL           LOG_LEVEL_TRACE
+#endif
+#endif
+
+#ifndef LOG_RECORDS
+#define LOG_RECORDS         1
+#endif
+
+/* Records a thread buffers before they are written. */
+#define LOG_BLOCK           4096
+
+/* Declaration a simulator can define to run around every message, e.g. to
+   time the console output. */
+#ifndef LOG_SCOPE
+#define LOG_SCOPE
+#endif
+
+/* Print msg, a chain of << operands, when level is compiled in. */
+#define LOG_AT(level, msg)  do { if (LOG_LEVEL >= (level)) { LOG_SCOPE; std::cout << msg << '\n'; } } while (0)
+#define LOG_INFO(msg)       LOG_AT(LOG_LEVEL_INFO, msg)
+#define LOG_TRACE(msg)      LOG_AT(LOG_LEVEL_TRACE, msg)
+
+/* Record an event when a record file is open. */
+#define LOG_RECORD(time, type, id, addr, arg) \
+    do { if (LOG_RECORDS && EventLog::is_open()) EventLog::record(time, type, id, addr, arg); } while (0)
+
+/* Recorded events. */
+enum LogEvent
+{
+    EV_READ,            // arg: 1 on a hit
+    EV_WRITE,           // arg: 1 on a hit
+    EV_SNOOP,           // arg: bus request << 16 | old state << 8 | new state
+};
+
+typedef struct {
+    uint64_t time;      // simulation time in units of the time resolution
+    uint64_t addr;
+    uint32_t arg;
+    uint16_t type;      // LogEvent
+    uint16_t id;        // cache or CPU
+} log_record_t;
+
+class EventLog
+{
+public:
+    /* Start recording to path, returns false when it cannot be created. */
+    static bool open(const char *path)
+    {
+        FILE *f = fopen(path, "wb");
+        if (f == NULL) return false;
+
+        fwrite("SIMLOG1", 1, 8, f);
+        file() = f;
+        return true;
+    }
+
+    static bool is_open()
+    {
+        return file() != NULL;
+    }
+
+    static void record(uint64_t time, int type, int id, uint64_t addr, uint32_t arg)
+    {
+        buffer_t *b = buffer();
+        log_record_t &r = b->records[b->count++];
+
+        r.time = time;
+        r.addr = addr;
+        r.arg = arg;
+        r.type = type;
+        r.id = id;
+
+        if (b->count == LOG_BLOCK) flush(b);
+    }
+
+    /* Write what every thread still buffers and close the file. The other
+       threads must be done recording. */
+    static void close()
+    {
+        if (file() == NULL) return;
+
+        for (buffer_t *b = buffers(); b != NULL; b = b->next) flush(b);
+        fclose(file());
+        file() = NULL;
+    }
+
+private:
+    typedef struct buffer {
+        int count;
+        log_record_t records[LOG_BLOCK];
+        struct buffer *next;
+    } buffer_t;
+
+    static FILE *&file()
+    {
+        static FILE *f = NULL;
+        return f;
+    }
+
+    static buffer_t *&buffers()
+    {
+        static buffer_t *list = NULL;
+        return list;
+    }
+
+    static pthread_mutex_t *lock()
+    {
+        static pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+        return &m;
+    }
+
+    /* Buffer of the calling thread, kept for the lifetime of the process. */
+    static buffer_t *buffer()
+    {
+        static __thread buffer_t *b = NULL;
+        if (b != NULL) return b;
+
+        b = new buffer_t;
+        b->count = 0;
+
+        pthread_mutex_lock(lock());
+        b->next = buffers();
+        buffers() = b;
+        pthread_mutex_unlock(lock());
+        return b;
+    }
+
+    static void flush(buffer_t *b)
+    {
+        pthread_mutex_lock(lock());
+        fwrite(b->records, sizeof(log_record_t), b->count, file());
+        pthread_mutex_unlock(lock());
+        b->count = 0;
+    }
+};
+
+#endif
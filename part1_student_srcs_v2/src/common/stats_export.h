@@ -0,0 +1,173 @@
+/*
+// File: stats_export.h
+//
+// Machine-readable statistics. Models register pointers to their counters
+// under dotted names ("cache.0.read_hits") once, before the run; the
+// values are read when a sample is taken and when the files are written.
+// sample() takes a row of every scalar counter, so a time series costs
+// nothing between samples.
+//
+// The JSON file holds the run information, the final value of every
+// counter, the per-set arrays and the samples. The CSV file has a header
+// line and one row per sample plus a final row, scalar counters only.
+*/
+
+#ifndef STATS_EXPORT_H
+#define STATS_EXPORT_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+class StatsExport
+{
+public:
+    StatsExport() : interval(0) {}
+
+    /* A line of run information, e.g. an option. */
+    void info(const std::string &name, const std::string &value)
+    {
+        infos.push_back(std::make_pair(name, value));
+    }
+
+    void counter(const std::string &name, const long *value)
+    {
+        scalars.push_back(std::make_pair(name, value));
+    }
+
+    /* An array of counters, e.g. one per cache set. Only in the JSON file. */
+    void counters(const std::string &name, const std::vector<long> *values)
+    {
+        arrays.push_back(std::make_pair(name, values));
+    }
+
+    /* Cycles between samples, recorded in the JSON file. */
+    void sample_interval(long cycles)
+    {
+        interval = cycles;
+    }
+
+    /* The scalar counters, in the order they were registered. */
+    size_t size() const
+    {
+        return scalars.size();
+    }
+
+    const std::string &name(size_t i) const
+    {
+        return scalars[i].first;
+    }
+
+    long value(size_t i) const
+    {
+        return *scalars[i].second;
+    }
+
+    /* Take a row of every scalar counter at cycle. */
+    void sample(long cycle)
+    {
+        std::vector<long> row;
+        row.push_back(cycle);
+        for (size_t i = 0; i < scalars.size(); i++) row.push_back(*scalars[i].second);
+        samples.push_back(row);
+    }
+
+    /* Write the final values at cycle to path, false if it cannot be created. */
+    bool write_json(const char *path, long cycle) const
+    {
+        FILE *f = fopen(path, "w");
+        if (f == NULL) return false;
+
+        fprintf(f, "{\n  \"info\": {");
+        for (size_t i = 0; i < infos.size(); i++)
+        {
+            fprintf(f, "%s\n    ", i ? "," : "");
+            quote(f, infos[i].first);
+            fprintf(f, ": ");
+            quote(f, infos[i].second);
+        }
+        fprintf(f, "\n  },\n  \"cycles\": %ld,\n  \"counters\": {", cycle);
+        for (size_t i = 0; i < scalars.size(); i++)
+        {
+            fprintf(f, "%s\n    ", i ? "," : "");
+            quote(f, scalars[i].first);
+            fprintf(f, ": %ld", *scalars[i].second);
+        }
+        fprintf(f, "\n  },\n  \"arrays\": {");
+        for (size_t i = 0; i < arrays.size(); i++)
+        {
+            fprintf(f, "%s\n    ", i ? "," : "");
+            quote(f, arrays[i].first);
+            fprintf(f, ": [");
+            const std::vector<long> &a = *arrays[i].second;
+            for (size_t j = 0; j < a.size(); j++) fprintf(f, "%s%ld", j ? ", " : "", a[j]);
+            fprintf(f, "]");
+        }
+        fprintf(f, "\n  },\n  \"samples\": {\n    \"interval\": %ld,\n    \"cycle\": [", interval);
+        column(f, 0);
+        fprintf(f, "]");
+        for (size_t i = 0; i < scalars.size(); i++)
+        {
+            fprintf(f, ",\n    ");
+            quote(f, scalars[i].first);
+            fprintf(f, ": [");
+            column(f, i + 1);
+            fprintf(f, "]");
+        }
+        fprintf(f, "\n  }\n}\n");
+
+        return fclose(f) == 0;
+    }
+
+    /* Write the samples and the final values at cycle to path. */
+    bool write_csv(const char *path, long cycle) const
+    {
+        FILE *f = fopen(path, "w");
+        if (f == NULL) return false;
+
+        fprintf(f, "cycle");
+        for (size_t i = 0; i < scalars.size(); i++) fprintf(f, ",%s", scalars[i].first.c_str());
+        fprintf(f, "\n");
+
+        for (size_t r = 0; r < samples.size(); r++)
+        {
+            for (size_t i = 0; i < samples[r].size(); i++) fprintf(f, "%s%ld", i ? "," : "", samples[r][i]);
+            fprintf(f, "\n");
+        }
+
+        fprintf(f, "%ld", cycle);
+        for (size_t i = 0; i < scalars.size(); i++) fprintf(f, ",%ld", *scalars[i].second);
+        fprintf(f, "\n");
+
+        return fclose(f) == 0;
+    }
+
+private:
+    std::vector< std::pair<std::string, std::string> > infos;
+    std::vector< std::pair<std::string, const long *> > scalars;
+    std::vector< std::pair<std::string, const std::vector<long> *> > arrays;
+    std::vector< std::vector<long> > samples;
+    long interval;
+
+    /* s as a JSON string. */
+    static void quote(FILE *f, const std::string &s)
+    {
+        fputc('"', f);
+        for (size_t i = 0; i < s.size(); i++)
+        {
+            if (s[i] == '"' || s[i] == '\\') fputc('\\', f);
+            if ((unsigned char)s[i] < 0x20) fprintf(f, "\\u%04x", s[i]);
+            else fputc(s[i], f);
+        }
+        fputc('"', f);
+    }
+
+    /* Column i of the samples, comma separated. */
+    void column(FILE *f, size_t i) const
+    {
+        for (size_t r = 0; r < samples.size(); r++) fprintf(f, "%s%ld", r ? ", " : "", samples[r][i]);
+    }
+};
+
+#endif
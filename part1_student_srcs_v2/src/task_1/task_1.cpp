@@ -31,16 +31,42 @@
 */
 
 #include "aca2009.h"
+#include "../common/log.h"
+#include "../common/config_file.h"
+#include "../common/stats_export.h"
 #include <systemc.h>
 #include <iostream>
 #include <iomanip>
+#include <vector>
 
 using namespace std;
 
+/* Default cache geometry, see --cache-size, --associativity and
+   --line-size. The line size and the number of sets must be powers of two. */
 #define MEM_SIZE            32768
 #define ASSOCIATIVITY       8
 #define LINE_SIZE           32
-#define NUM_SETS            ( ( MEM_SIZE / LINE_SIZE ) / ASSOCIATIVITY )
+
+/* Largest line size, line data is kept in arrays of this size. */
+#define MAX_LINE_SIZE       256
+
+/* Default cycles main memory needs to return or take a line. */
+#define MEM_LATENCY         100
+
+/* Default cycles for a cache hit. */
+#define HIT_LATENCY         1
+
+/* Cache geometry in bytes and latencies in cycles, set by sc_main. */
+static int cache_size = MEM_SIZE;
+static int associativity = ASSOCIATIVITY;
+static int line_size = LINE_SIZE;
+static int num_sets;
+static int mem_latency = MEM_LATENCY;
+static int hit_latency = HIT_LATENCY;
+
+/* Files for the counters, see --stats-json and --stats-csv. */
+static const char *stats_json = NULL;
+static const char *stats_csv = NULL;
 
 SC_MODULE(Memory) 
 {
@@ -64,42 +90,63 @@ public:
     sc_out<RetCode> Port_Done;
     sc_inout_rv<8> Port_Data;
 
+    /* Hits and misses. */
+    long read_hits;
+    long read_misses;
+    long write_hits;
+    long write_misses;
+
     SC_CTOR(Memory) 
     {
+        read_hits = 0;
+        read_misses = 0;
+        write_hits = 0;
+        write_misses = 0;
+
         SC_THREAD(execute);
         sensitive << Port_CLK.pos();
         dont_initialize();
 
-        cache = new cache_line_t[NUM_SETS][ASSOCIATIVITY];
+        cache.assign(num_sets, vector<cache_line_t>(associativity));
     }
 
-    ~Memory() 
+    void watch(StatsExport &stats, const string &prefix)
     {
-        delete[] cache;
+        stats.counter(prefix + ".read_hits", &read_hits);
+        stats.counter(prefix + ".read_misses", &read_misses);
+        stats.counter(prefix + ".write_hits", &write_hits);
+        stats.counter(prefix + ".write_misses", &write_misses);
     }
 
 private:
 
-    typedef union {
-        struct {
-            uint32_t offset: 5;
-            uint32_t set: 7;
-            uint32_t tag: 20;
-        };
+    typedef struct {
         uint32_t addr;
+        uint32_t offset;
+        uint32_t set;
+        uint32_t tag;
     } mem_addr_t;
 
+    static mem_addr_t decode(uint32_t addr) {
+        mem_addr_t mem_addr;
+        mem_addr.addr = addr;
+        mem_addr.offset = addr % line_size;
+        mem_addr.set = (addr / line_size) % num_sets;
+        mem_addr.tag = addr / line_size / num_sets;
+        return mem_addr;
+    }
+
     typedef struct {
         uint8_t age;
         uint32_t tag;
-        uint8_t data[32];
+        uint8_t data[MAX_LINE_SIZE];
     } cache_line_t;
 
-    cache_line_t (*cache)[ASSOCIATIVITY];
+    vector< vector<cache_line_t> > cache;
 
-    uint8_t get_LRU_line(uint8_t set) {
+    uint8_t get_LRU_line(uint32_t set) {
 
-        for (int i = 0; i < ASSOCIATIVITY; i++){
+        for (int i = 0; i < associativity; i++){
 
             //If a line hasn't been used yet, use it
             if (cache[set][i].age == 0) return i;
@@ -109,7 +156,7 @@ private:
         uint8_t highest_age = 0;
         uint8_t LRU_line;
 
-        for (int i = 0; i < ASSOCIATIVITY; i++){
+        for (int i = 0; i < associativity; i++){
             if (cache[set][i].age > highest_age) {
                 highest_age = cache[set][i].age;
                 LRU_line = i;
@@ -118,7 +165,7 @@ private:
         return LRU_line;
     }
 
-      void update_LRU(uint8_t set, uint8_t MRU_line) {
+      void update_LRU(uint32_t set, uint8_t MRU_line) {
 
         //The line was already the most recently used, nothing to be done
         if (cache[set][MRU_line].age == 1) return;
@@ -130,7 +177,7 @@ private:
         cache[set][MRU_line].age = 1;
 
         if (previous_age == 0) {
-            for (int i = 0; i < ASSOCIATIVITY; i++) {
+            for (int i = 0; i < associativity; i++) {
                 //A cache line's age shouldn't be increased if:
                 //- the line is empty
                 //- the line is the one that we just used
@@ -139,7 +186,7 @@ private:
             }
         }
         else {
-            for (int i = 0; i < ASSOCIATIVITY; i++){
+            for (int i = 0; i < associativity; i++){
 
                 //A cache line's age shouldn't be increased if:
                 //- the line is empty
@@ -163,11 +210,11 @@ private:
             wait(Port_Func.value_changed_event());  // this is fine since we use sc_buffer
             
             Function f = Port_Func.read();
-            mem_addr.addr = Port_Addr.read();
+            mem_addr = decode(Port_Addr.read());
 
             hit = false;
             // First determine hit or miss
-            for (int i = 0; i < ASSOCIATIVITY; i++) {
+            for (int i = 0; i < associativity; i++) {
                 if (cache[mem_addr.set][i].tag == mem_addr.tag) {
                     hit = true;
                     target_line = i;
@@ -178,40 +225,43 @@ private:
             // - If hit:    update the cache line
             //              update the LRU indices
             // - If miss:   determine LRU cache line
-            //              write it back to RAM (wait 100 cycles)
+            //              write it back to RAM (wait mem_latency cycles)
             //              replace data
             //              update the LRU indices
 
             if (f == FUNC_WRITE) {
-                cout << sc_time_stamp() << ": MEM received write" << endl;
+                LOG_TRACE(sc_time_stamp() << ": MEM received write");
+                LOG_RECORD(sc_time_stamp().value(), EV_WRITE, 0, mem_addr.addr, hit);
                 data = (uint8_t)Port_Data.read().to_int();
                 
                 if (hit) {
                     stats_writehit(0);
+                    write_hits++;
 
                     //Update the cache line
                     cache[mem_addr.set][target_line].data[mem_addr.offset] = data;
 
                     //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
+                    update_LRU(mem_addr.set, target_line);
 
-                    wait(1);
+                    wait(hit_latency);
                 }
                 else {
                     stats_writemiss(0);
-                    cout << "WRITE MISS" << endl;
+                    write_misses++;
+                    LOG_TRACE("WRITE MISS");
                     //Determine LRU line
-                    target_line = get_LRU_line((uint8_t)mem_addr.set);
+                    target_line = get_LRU_line(mem_addr.set);
 
-                    //Write back to RAM (wait 100 cycles)
-                    wait(100);
+                    //Write back to RAM (wait mem_latency cycles)
+                    wait(mem_latency);
 
                     //Write new data in LRU line
                     cache[mem_addr.set][target_line].tag = mem_addr.tag;
                     cache[mem_addr.set][target_line].data[mem_addr.offset] = data;
 
                     //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
+                    update_LRU(mem_addr.set, target_line);
                 }
                 Port_Done.write( RET_WRITE_DONE );
             }
@@ -221,32 +271,35 @@ private:
             //              update the LRU indices
             // - If miss:   determine LRU cache line
             //              write it back to RAM
-            //              replace data with some random data (wait 100 cycles)
+            //              replace data with some random data (wait mem_latency cycles)
             //              return the cache line
             //              update the LRU indices
 
             if (f == FUNC_READ) {
-                cout << sc_time_stamp() << ": MEM received read" << endl;
+                LOG_TRACE(sc_time_stamp() << ": MEM received read");
+                LOG_RECORD(sc_time_stamp().value(), EV_READ, 0, mem_addr.addr, hit);
 
                 if (hit) {
                     stats_readhit(0);
+                    read_hits++;
 
                     //Return the cache line
                     Port_Data.write(cache[mem_addr.set][target_line].data[mem_addr.offset]);
-                    wait(1);
+                    wait(hit_latency);
 
                     //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
+                    update_LRU(mem_addr.set, target_line);
                 }
                 else {
                     stats_readmiss(0);
-                    cout << "READ MISS" << endl;
+                    read_misses++;
+                    LOG_TRACE("READ MISS");
 
                     //Determine LRU line
-                    target_line = get_LRU_line((uint8_t)mem_addr.set);
+                    target_line = get_LRU_line(mem_addr.set);
 
                     //Write back to RAM
-                    wait(100);
+                    wait(mem_latency);
 
                     //Replace data with something from RAM
                     cache[mem_addr.set][target_line].tag = mem_addr.tag;
@@ -256,7 +309,7 @@ private:
                     Port_Data.write(cache[mem_addr.set][target_line].data[mem_addr.offset]);
 
                     //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
+                    update_LRU(mem_addr.set, target_line);
                 }
 
                 Port_Done.write( RET_READ_DONE );
@@ -324,7 +377,7 @@ private:
 
                 if (f == Memory::FUNC_WRITE) 
                 {
-                    cout << sc_time_stamp() << ": CPU sends write" << endl;
+                    LOG_TRACE(sc_time_stamp() << ": CPU sends write");
 
                     uint8_t data = rand() % 255;
                     Port_MemData.write(data);
@@ -333,19 +386,19 @@ private:
                 }
                 else
                 {
-                    cout << sc_time_stamp() << ": CPU sends read" << endl;
+                    LOG_TRACE(sc_time_stamp() << ": CPU sends read");
                 }
 
                 wait(Port_MemDone.value_changed_event());
 
                 if (f == Memory::FUNC_READ)
                 {
-                    cout << sc_time_stamp() << ": CPU reads: " << Port_MemData.read() << endl;
+                    LOG_TRACE(sc_time_stamp() << ": CPU reads: " << Port_MemData.read());
                 }
             }
             else
             {
-                cout << sc_time_stamp() << ": CPU executes NOP" << endl;
+                LOG_TRACE(sc_time_stamp() << ": CPU executes NOP");
             }
             // Advance one cycle in simulated time            
             wait();
@@ -357,10 +410,126 @@ private:
 };
 
 
+/* Take our own options out of argv, "--records <path>" starts recording
+   events. Returns false on a malformed option, throws on a cache geometry
+   that cannot be built. */
+static bool parse_options(int *argc, char ***argv)
+{
+    char **args = *argv;
+    int n = 1;
+
+    for (int i = 1; i < *argc; i++)
+    {
+        if (strcmp(args[i], "--records") == 0)
+        {
+            // Binary event records, see common/log.h
+            if (i + 1 >= *argc) return false;
+            if (!EventLog::open(args[++i])) throw runtime_error(string("cannot create ") + args[i]);
+        }
+        else if (strcmp(args[i], "--cache-size") == 0)
+        {
+            // Cache size in bytes
+            if (i + 1 >= *argc) return false;
+            cache_size = atoi(args[++i]);
+            if (cache_size <= 0) return false;
+        }
+        else if (strcmp(args[i], "--associativity") == 0)
+        {
+            // Ways per set
+            if (i + 1 >= *argc) return false;
+            associativity = atoi(args[++i]);
+            if (associativity <= 0) return false;
+        }
+        else if (strcmp(args[i], "--line-size") == 0)
+        {
+            // Line size in bytes
+            if (i + 1 >= *argc) return false;
+            line_size = atoi(args[++i]);
+            if (line_size <= 0) return false;
+        }
+        else if (strcmp(args[i], "--hit-latency") == 0)
+        {
+            // Cycles for a cache hit
+            if (i + 1 >= *argc) return false;
+            hit_latency = atoi(args[++i]);
+            if (hit_latency <= 0) return false;
+        }
+        else if (strcmp(args[i], "--mem-latency") == 0)
+        {
+            // Cycles for main memory to return or take a line
+            if (i + 1 >= *argc) return false;
+            mem_latency = atoi(args[++i]);
+            if (mem_latency <= 0) return false;
+        }
+        else if (strcmp(args[i], "--stats-json") == 0)
+        {
+            // Counters as JSON, see common/stats_export.h
+            if (i + 1 >= *argc) return false;
+            stats_json = args[++i];
+        }
+        else if (strcmp(args[i], "--stats-csv") == 0)
+        {
+            // Counters as CSV
+            if (i + 1 >= *argc) return false;
+            stats_csv = args[++i];
+        }
+        else
+        {
+            args[n++] = args[i];
+        }
+    }
+
+    *argc = n;
+    args[n] = NULL;
+
+    // Ages are kept in a byte, see update_LRU()
+    num_sets = cache_size / line_size / associativity;
+    if (associativity > 255 || line_size > MAX_LINE_SIZE || num_sets <= 0 ||
+        num_sets * line_size * associativity != cache_size ||
+        (line_size & (line_size - 1)) || (num_sets & (num_sets - 1)))
+    {
+        throw invalid_argument("The line size and the number of sets must be powers of two, "
+                               "with at most 255 ways and 256 byte lines");
+    }
+    return true;
+}
+
+/* Echo the parameters of the run with the statistics. */
+static void print_configuration()
+{
+    printf("\nConfiguration\n");
+    printf("    %-20s %d\n", "cpus", num_cpus);
+    printf("    %-20s %d\n", "cache-size", cache_size);
+    printf("    %-20s %d\n", "associativity", associativity);
+    printf("    %-20s %d\n", "line-size", line_size);
+    printf("    %-20s %d\n", "hit-latency", hit_latency);
+    printf("    %-20s %d\n", "mem-latency", mem_latency);
+}
+
 int sc_main(int argc, char* argv[])
 {
     try
     {
+        // The command line goes into the stats files
+        string command = argv[0];
+        for (int i = 1; i < argc; i++) command += string(" ") + argv[i];
+
+        ConfigFile config_file;
+        config_file.apply(&argc, &argv);
+
+        if (!parse_options(&argc, &argv))
+        {
+            cerr << "usage: " << argv[0] << " [--records <path>] [--config <path>] [--cache-size <bytes>] [--associativity <ways>] [--line-size <bytes>] [--hit-latency <cycles>] [--mem-latency <cycles>] [--stats-json <path>] [--stats-csv <path>] tracefile" << endl;
+            return 1;
+        }
+
+        // What is left of the config file was not one of our options
+        for (int i = 1; i < argc; i++)
+        {
+            const char *origin = config_file.origin(argv[i]);
+            if (origin != NULL) throw invalid_argument(string(origin) + ": unknown option " + argv[i]);
+        }
+
         // Get the tracefile argument and create Tracefile object
         // This function sets tracefile_ptr and num_cpus
         init_tracefile(&argc, &argv);
@@ -395,13 +564,24 @@ int sc_main(int argc, char* argv[])
         mem.Port_CLK(clk);
         cpu.Port_CLK(clk);
 
-        cout << "Running (press CTRL+C to interrupt)... " << endl;
+        // Counters for the stats files
+        StatsExport stats;
+        stats.info("command", command);
+        mem.watch(stats, "cache.0");
+
+        LOG_INFO("Running (press CTRL+C to interrupt)... ");
 
 
         // Start Simulation
         sc_start();
+        EventLog::close();
+
+        long cycles = sc_time_stamp() / clk.period();
+        if (stats_json != NULL && !stats.write_json(stats_json, cycles)) cerr << "cannot write " << stats_json << endl;
+        if (stats_csv != NULL && !stats.write_csv(stats_csv, cycles)) cerr << "cannot write " << stats_csv << endl;
         
         // Print statistics after simulation finished
+        print_configuration();
         stats_print();
     }
 
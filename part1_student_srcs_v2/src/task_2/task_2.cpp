@@ -31,26 +31,55 @@
 */
 
 #include "aca2009.h"
+#include "../common/config_file.h"
+#include "../common/stats_export.h"
 #include <systemc.h>
 #include <iostream>
 #include <iomanip>
+#include <vector>
 
 using namespace std;
 
+/* Default cache geometry, see --cache-size, --associativity and
+   --line-size. The line size and the number of sets must be powers of two. */
 #define MEM_SIZE            32768
 #define ASSOCIATIVITY       8
 #define LINE_SIZE           32
-#define NUM_SETS            ( ( MEM_SIZE / LINE_SIZE ) / ASSOCIATIVITY )
 
+/* Largest line size, line data is kept in arrays of this size. */
+#define MAX_LINE_SIZE       256
+
+/* Default cycles main memory needs to return or take a line. */
+#define MEM_LATENCY         100
+
+/* Default cycles for a cache hit. */
+#define HIT_LATENCY         1
+
+/* Cache geometry in bytes and latencies in cycles, set by sc_main. */
+static int cache_size = MEM_SIZE;
+static int associativity = ASSOCIATIVITY;
+static int line_size = LINE_SIZE;
+static int num_sets;
+static int mem_latency = MEM_LATENCY;
+static int hit_latency = HIT_LATENCY;
+
+/* Files for the counters, see --stats-json and --stats-csv. */
+static const char *stats_json = NULL;
+static const char *stats_csv = NULL;
+
+/* Width of addresses on the CPU ports and the bus. */
+#define ADDR_BITS           64
+
+typedef uint64_t addr_t;
 
 
 /* Bus interface, modified version from assignment. */
 class Bus_if : public virtual sc_interface 
 {
     public:
-        virtual bool Rd(int writer, int addr) = 0;
-        virtual bool Wr(int writer, int addr, int data) = 0;
-        virtual bool RdX(int writer, int addr) = 0;
+        virtual bool Rd(int writer, addr_t addr) = 0;
+        virtual bool Wr(int writer, addr_t addr, int data) = 0;
+        virtual bool RdX(int writer, addr_t addr) = 0;
 };
 
 
@@ -90,7 +119,7 @@ public:
 
     sc_in<bool>     Port_CLK;
     sc_in<Function> Port_Func;
-    sc_in<int>      Port_Addr;
+    sc_in<addr_t>   Port_Addr;
     sc_out<RetCode> Port_Done;
     sc_inout_rv<8>  Port_Data;
     sc_out<uint8_t> Set_No;
@@ -100,7 +129,7 @@ public:
 
 
     /* Bus snooping ports. */
-    sc_in_rv<32>    Port_BusAddr;
+    sc_in_rv<ADDR_BITS> Port_BusAddr;
     sc_in<int>      Port_BusWriter;
     sc_in<BusRequest> Port_BusValid;
 
@@ -109,48 +138,74 @@ public:
 
     /* Variables. */
     int cache_id;
+    long probeRead;
+    long probeWrite;
+
+    /* Hits and misses. */
+    long read_hits;
+    long read_misses;
+    long write_hits;
+    long write_misses;
 
 
     SC_CTOR(Cache) 
     {
         cache_id = 0;
+        probeRead = 0;
+        probeWrite = 0;
+        read_hits = 0;
+        read_misses = 0;
+        write_hits = 0;
+        write_misses = 0;
         SC_THREAD(bus); //*********************** thread for bus
         SC_THREAD(execute);
         sensitive << Port_CLK.pos();
         dont_initialize();
 
-        cache = new cache_line_t[NUM_SETS][ASSOCIATIVITY];
+        cache.assign(num_sets, vector<cache_line_t>(associativity));
     }
 
-    ~Cache() 
+    void watch(StatsExport &stats, const string &prefix)
     {
-        delete[] cache;
+        stats.counter(prefix + ".read_hits", &read_hits);
+        stats.counter(prefix + ".read_misses", &read_misses);
+        stats.counter(prefix + ".write_hits", &write_hits);
+        stats.counter(prefix + ".write_misses", &write_misses);
+        stats.counter(prefix + ".probe_reads", &probeRead);
+        stats.counter(prefix + ".probe_writes", &probeWrite);
     }
 
 private:
 
-    typedef union {
-        struct {
-            uint32_t offset: 5;
-            uint32_t set: 7;
-            uint32_t tag: 20;
-        };
-        uint32_t addr;
+    typedef struct {
+        addr_t addr;
+        uint32_t offset;
+        uint32_t set;
+        addr_t tag;
     } mem_addr_t;
 
+    static mem_addr_t decode(addr_t addr) {
+        mem_addr_t mem_addr;
+        mem_addr.addr = addr;
+        mem_addr.offset = addr % line_size;
+        mem_addr.set = (addr / line_size) % num_sets;
+        mem_addr.tag = addr / line_size / num_sets;
+        return mem_addr;
+    }
+
     typedef struct cache_line{
         cache_line() : valid(false) {}
         bool valid;
         uint8_t age;
-        uint32_t tag;
-        uint8_t data[32];
+        addr_t tag;
+        uint8_t data[MAX_LINE_SIZE];
     } cache_line_t;
 
-    cache_line_t (*cache)[ASSOCIATIVITY];
+    vector< vector<cache_line_t> > cache;
 
-    uint8_t get_LRU_line(uint8_t set) {
+    uint8_t get_LRU_line(uint32_t set) {
 
-        for (int i = 0; i < ASSOCIATIVITY; i++){
+        for (int i = 0; i < associativity; i++){
 
             //If a line hasn't been used yet, use it
             if (cache[set][i].age == 0) return i;
@@ -160,7 +215,7 @@ private:
         uint8_t highest_age = 0;
         uint8_t LRU_line;
 
-        for (int i = 0; i < ASSOCIATIVITY; i++){
+        for (int i = 0; i < associativity; i++){
             if (cache[set][i].age > highest_age) {
                 highest_age = cache[set][i].age;
                 LRU_line = i;
@@ -169,7 +224,7 @@ private:
         return LRU_line;
     }
 
-      void update_LRU(uint8_t set, uint8_t MRU_line) {
+      void update_LRU(uint32_t set, uint8_t MRU_line) {
 
         //The line was already the most recently used, nothing to be done
         if (cache[set][MRU_line].age == 1) return;
@@ -181,7 +236,7 @@ private:
         cache[set][MRU_line].age = 1;
 
         if (previous_age == 0) {
-            for (int i = 0; i < ASSOCIATIVITY; i++) {
+            for (int i = 0; i < associativity; i++) {
                 //A cache line's age shouldn't be increased if:
                 //- the line is empty
                 //- the line is the one that we just used
@@ -190,7 +245,7 @@ private:
             }
         }
         else {
-            for (int i = 0; i < ASSOCIATIVITY; i++){
+            for (int i = 0; i < associativity; i++){
 
                 //A cache line's age shouldn't be increased if:
                 //- the line is empty
@@ -208,8 +263,6 @@ private:
         BusRequest br;
         mem_addr_t mem_addr;
         int writer;
-        int probeRead = 0;
-        int probeWrite = 0;
         /* Continue while snooping is activated. */
        // cout << "core " << cache_id << " begins to snoop" <<endl;
 
@@ -219,7 +272,7 @@ private:
             wait(Port_BusValid.value_changed_event());
             
                 /* preparation for bus work*/
-            mem_addr.addr = Port_BusAddr.read().to_int();
+            mem_addr = decode(Port_BusAddr.read().to_uint64());
             br = Port_BusValid.read();
             writer = Port_BusWriter.read();
 
@@ -244,7 +297,7 @@ private:
                     case BUS_READ:
                     {// nothing special needed to be done
 
-                        for ( int i=0; i< ASSOCIATIVITY;i++)
+                        for ( int i=0; i< associativity;i++)
                         {
                             if (cache[mem_addr.set][i].tag == mem_addr.tag)
                             {   
@@ -262,7 +315,7 @@ private:
 
                     case BUS_WRITE:
                     {
-                        for ( int i=0; i< ASSOCIATIVITY;i++)
+                        for ( int i=0; i< associativity;i++)
                         {
                             if (cache[mem_addr.set][i].tag == mem_addr.tag)
                             {   
@@ -279,7 +332,7 @@ private:
             // the diference of READX and WRITE is just the probe counter.
                     case BUS_READX:
                     {
-                        for ( int i=0; i< ASSOCIATIVITY;i++)
+                        for ( int i=0; i< associativity;i++)
                         {
                             if (cache[mem_addr.set][i].tag == mem_addr.tag)
                             {   
@@ -318,7 +371,7 @@ private:
             wait(Port_Func.value_changed_event());  // this is fine since we use sc_buffer
             
             Function f = Port_Func.read();
-            mem_addr.addr = Port_Addr.read();
+            mem_addr = decode(Port_Addr.read());
 
 
           //  cout << "@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@"<< endl;
@@ -330,7 +383,7 @@ private:
 
             hit = false;
             // First determine hit or miss
-            for (int i = 0; i < ASSOCIATIVITY; i++) {
+            for (int i = 0; i < associativity; i++) {
                 if (cache[mem_addr.set][i].tag == mem_addr.tag && cache[mem_addr.set][i].valid) {
                     hit = true;
                     target_line = i;
@@ -343,8 +396,8 @@ private:
             //              set the dirty bit
             //              update the LRU indices
             // - If miss:   determine LRU cache line
-            //              write it back to RAM if line is dirty (wait 100 cycles)
-            //              replace data (wait 100 cycles)
+            //              write it back to RAM if line is dirty (wait mem_latency cycles)
+            //              replace data (wait mem_latency cycles)
             //              write new data
             //              set the dirty bit
             //              update the LRU indices
@@ -357,6 +410,7 @@ private:
                 if (hit) {
 
                     stats_writehit(cache_id);
+                    write_hits++;
                     // when it is write hit on a valid line, issue a BUS WRITE to invalidate other copies.
                     if (cache[mem_addr.set][target_line].valid == true)
                     {
@@ -371,7 +425,7 @@ private:
 
                         // fetch the data from memory
                         data = (uint8_t)(rand() % 255);
-                        wait(100);
+                        wait(mem_latency);
                     }
 
                         
@@ -381,7 +435,7 @@ private:
 
                     cache[mem_addr.set][target_line].valid = true;
                     //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
+                    update_LRU(mem_addr.set, target_line);
 
                     Set_No = mem_addr.set;
                     Line_No = target_line;
@@ -389,29 +443,30 @@ private:
                     
 
                     // write through to memory
-                    wait(100); 
+                    wait(mem_latency); 
 
                 }
                 else {
                     // when it is a write miss, issue a BUS RDX to read data from memory  ???? 
 
                     stats_writemiss(cache_id);
+                    write_misses++;
 
                 //    cout << "FUNC_WRITE          "<< "Miss        " <<  "  cache_id:           " << cache_id << endl;
                     Port_Bus->RdX(cache_id,mem_addr.addr);
                     data = (uint8_t)(rand() % 255);
-                    wait(100);
+                    wait(mem_latency);
                    
 
                     //Determine LRU line
-                    target_line = get_LRU_line((uint8_t)mem_addr.set);
+                    target_line = get_LRU_line(mem_addr.set);
                     Line_No = target_line;
                     Set_No = mem_addr.set;
 
 
-                    //Read new line from RAM (wait 100 cycles)
-                    for (int i = 0; i < LINE_SIZE; i++) cache[mem_addr.set][target_line].data[i] = (uint8_t)(rand() % 255);
-                    wait(100);
+                    //Read new line from RAM (wait mem_latency cycles)
+                    for (int i = 0; i < line_size; i++) cache[mem_addr.set][target_line].data[i] = (uint8_t)(rand() % 255);
+                    wait(mem_latency);
 
                     //Write new data in LRU line
                     cache[mem_addr.set][target_line].tag = mem_addr.tag;
@@ -419,7 +474,7 @@ private:
                     cache[mem_addr.set][target_line].valid = true;
 
                     //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
+                    update_LRU(mem_addr.set, target_line);
                 }
                 Port_Done.write( RET_WRITE_DONE );
             }
@@ -429,7 +484,7 @@ private:
             //              update the LRU indices
             // - If miss:   determine LRU cache line
             //              write it back to RAM
-            //              replace data with some random data (wait 100 cycles)
+            //              replace data with some random data (wait mem_latency cycles)
             //              return the cache line
             //              update the LRU indices
 
@@ -440,6 +495,7 @@ private:
                 if (hit) {   
                     // when it is a valid line, delivery a hit
                     stats_readhit(cache_id);
+                    read_hits++;
 
                     if(cache[mem_addr.set][target_line].valid == true)
                     {
@@ -449,16 +505,16 @@ private:
                     {
                     //    cout << "FUNC_READ         "<< "Hit:        Invalid " << "  cache_id:           " << cache_id <<  endl;
                         Port_Bus->Rd(cache_id,mem_addr.addr);
-                        wait(100);
+                        wait(mem_latency);
                     }
                        
 
                         //Return the cache line
                     Port_Data.write(cache[mem_addr.set][target_line].data[mem_addr.offset]);
-                    wait(1);
+                    wait(hit_latency);
 
                     //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
+                    update_LRU(mem_addr.set, target_line);
                     Set_No = mem_addr.set;
                     Line_No = target_line;
 
@@ -469,13 +525,14 @@ private:
                     // when it is a read MISS, issue BUS READ for memory`s reply
 
                     stats_readmiss(cache_id);
+                    read_misses++;
 
                     Port_Bus->Rd(cache_id,mem_addr.addr);
 
                     
                    // cout << "FUNC_READ          "<< "Miss" <<   "  cache_id:           " << cache_id << endl;
                     //Determine LRU line
-                    target_line = get_LRU_line((uint8_t)mem_addr.set);
+                    target_line = get_LRU_line(mem_addr.set);
                     Line_No = target_line;
                     Set_No = mem_addr.set;
                     //cout<<"Miss Line Number: "<<unsigned(target_line)<<endl;
@@ -484,16 +541,16 @@ private:
 
                     //Replace data with something from RAM
                     cache[mem_addr.set][target_line].tag = mem_addr.tag;
-                    for (int i = 0; i < LINE_SIZE; i++) cache[mem_addr.set][target_line].data[i] = (uint8_t)(rand() % 255);
+                    for (int i = 0; i < line_size; i++) cache[mem_addr.set][target_line].data[i] = (uint8_t)(rand() % 255);
 
                     cache[mem_addr.set][target_line].valid = true;
-                    wait(100);
+                    wait(mem_latency);
 
                     //Return the cache line
                     Port_Data.write(cache[mem_addr.set][target_line].data[mem_addr.offset]);
 
                     //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
+                    update_LRU(mem_addr.set, target_line);
                 }
 
                 Port_Done.write( RET_READ_DONE );
@@ -511,7 +568,7 @@ public:
     sc_in<bool>                 Port_CLK;
     sc_in<Cache::RetCode>      Port_MemDone;
     sc_out<Cache::Function>    Port_MemFunc;
-    sc_out<int>                 Port_MemAddr;
+    sc_out<addr_t>              Port_MemAddr;
     sc_inout_rv<8>              Port_MemData;
 
     int cpu_id;
@@ -607,7 +664,7 @@ public:
     sc_out<Cache::BusRequest> Port_BusValid;
     sc_out<int> Port_BusWriter;
 
-    sc_signal_rv<32> Port_BusAddr;
+    sc_signal_rv<ADDR_BITS> Port_BusAddr;
 
     /* Bus mutex. */
     sc_mutex bus;
@@ -624,7 +681,7 @@ public:
         sensitive << Port_CLK.pos();
 
         // Initialize some bus properties
-        Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(SC_LOGIC_Z));
 
         /* Update variables. */
         waits = 0;
@@ -633,7 +690,7 @@ public:
     }
 
     /* Perform a read access to memory addr for CPU #writer. */
-    virtual bool Rd(int writer, int addr){
+    virtual bool Rd(int writer, addr_t addr){
         /* Try to get exclusive lock on bus. */
         while(bus.trylock() == -1){
             /* Wait when bus is in contention. */
@@ -645,7 +702,7 @@ public:
         reads++;
 
         /* Set lines. */
-        Port_BusAddr.write(addr);
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(addr));
         Port_BusWriter.write(writer);
         Port_BusValid.write(Cache::BUS_READ);
 
@@ -653,14 +710,14 @@ public:
         wait();
 
      //   Port_BusValid.write(Cache::BUS_FREE);
-        Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(SC_LOGIC_Z));
         bus.unlock();
 
         return(true);
     };
 
     /* Write action to memory, need to know the writer, address and data. */
-    virtual bool Wr(int writer, int addr, int data){
+    virtual bool Wr(int writer, addr_t addr, int data){
         /* Try to get exclusive lock on the bus. */
         while(bus.trylock() == -1){
             waits++;
@@ -671,7 +728,7 @@ public:
         writes++;
 
         /* Set. */
-        Port_BusAddr.write(addr);
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(addr));
         Port_BusWriter.write(writer);
         Port_BusValid.write(Cache::BUS_WRITE);
 
@@ -680,13 +737,13 @@ public:
 
         /* Reset. */
      //   Port_BusValid.write(Cache::BUS_FREE);
-        Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(SC_LOGIC_Z));
         bus.unlock();
 
         return(true);
     }
 
-    virtual bool RdX(int writer, int addr){
+    virtual bool RdX(int writer, addr_t addr){
         /* Try to get exclusive lock on the bus. */
         while(bus.trylock() == -1){
             waits++;
@@ -697,7 +754,7 @@ public:
         reads++;
 
         /* Set lines. */
-        Port_BusAddr.write(addr);
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(addr));
         Port_BusWriter.write(writer);
         Port_BusValid.write(Cache::BUS_READX);
 
@@ -705,7 +762,7 @@ public:
         wait();
 
       //  Port_BusValid.write(Cache::BUS_FREE);
-        Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(SC_LOGIC_Z));
         bus.unlock();
 
         return(true);
@@ -716,19 +773,135 @@ public:
         /* Write output as specified in the assignment. */
         double avg = (double)waits / double(reads + writes);
         printf("\n 2. Main memory access rates\n");
-        printf("    Bus had %d reads and %d writes.\n", reads, writes);
-        printf("    A total of %d accesses.\n", reads + writes);
+        printf("    Bus had %ld reads and %ld writes.\n", reads, writes);
+        printf("    A total of %ld accesses.\n", reads + writes);
         printf("\n 3. Average time for bus acquisition\n");
-        printf("    There were %d waits for the bus.\n", waits);
+        printf("    There were %ld waits for the bus.\n", waits);
         printf("    Average waiting time per access: %f cycles.\n", avg);
     }
+
+    void watch(StatsExport &stats)
+    {
+        stats.counter("bus.reads", &reads);
+        stats.counter("bus.writes", &writes);
+        stats.counter("bus.waits", &waits);
+    }
 };
 
 
+/* Take our own options out of argv. Returns false on a malformed option,
+   throws on a cache geometry that cannot be built. */
+static bool parse_options(int *argc, char ***argv)
+{
+    char **args = *argv;
+    int n = 1;
+
+    for (int i = 1; i < *argc; i++)
+    {
+        if (strcmp(args[i], "--cache-size") == 0)
+        {
+            // Cache size in bytes
+            if (i + 1 >= *argc) return false;
+            cache_size = atoi(args[++i]);
+            if (cache_size <= 0) return false;
+        }
+        else if (strcmp(args[i], "--associativity") == 0)
+        {
+            // Ways per set
+            if (i + 1 >= *argc) return false;
+            associativity = atoi(args[++i]);
+            if (associativity <= 0) return false;
+        }
+        else if (strcmp(args[i], "--line-size") == 0)
+        {
+            // Line size in bytes
+            if (i + 1 >= *argc) return false;
+            line_size = atoi(args[++i]);
+            if (line_size <= 0) return false;
+        }
+        else if (strcmp(args[i], "--hit-latency") == 0)
+        {
+            // Cycles for a cache hit
+            if (i + 1 >= *argc) return false;
+            hit_latency = atoi(args[++i]);
+            if (hit_latency <= 0) return false;
+        }
+        else if (strcmp(args[i], "--mem-latency") == 0)
+        {
+            // Cycles for main memory to return or take a line
+            if (i + 1 >= *argc) return false;
+            mem_latency = atoi(args[++i]);
+            if (mem_latency <= 0) return false;
+        }
+        else if (strcmp(args[i], "--stats-json") == 0)
+        {
+            // Counters as JSON, see common/stats_export.h
+            if (i + 1 >= *argc) return false;
+            stats_json = args[++i];
+        }
+        else if (strcmp(args[i], "--stats-csv") == 0)
+        {
+            // Counters as CSV
+            if (i + 1 >= *argc) return false;
+            stats_csv = args[++i];
+        }
+        else
+        {
+            args[n++] = args[i];
+        }
+    }
+
+    *argc = n;
+    args[n] = NULL;
+
+    // Ages are kept in a byte, see update_LRU()
+    num_sets = cache_size / line_size / associativity;
+    if (associativity > 255 || line_size > MAX_LINE_SIZE || num_sets <= 0 ||
+        num_sets * line_size * associativity != cache_size ||
+        (line_size & (line_size - 1)) || (num_sets & (num_sets - 1)))
+    {
+        throw invalid_argument("The line size and the number of sets must be powers of two, "
+                               "with at most 255 ways and 256 byte lines");
+    }
+    return true;
+}
+
+/* Echo the parameters of the run with the statistics. */
+static void print_configuration()
+{
+    printf("\nConfiguration\n");
+    printf("    %-20s %d\n", "cpus", num_cpus);
+    printf("    %-20s %d\n", "cache-size", cache_size);
+    printf("    %-20s %d\n", "associativity", associativity);
+    printf("    %-20s %d\n", "line-size", line_size);
+    printf("    %-20s %d\n", "hit-latency", hit_latency);
+    printf("    %-20s %d\n", "mem-latency", mem_latency);
+}
+
 int sc_main(int argc, char* argv[])
 {
     try
     {
+        // The command line goes into the stats files
+        string command = argv[0];
+        for (int i = 1; i < argc; i++) command += string(" ") + argv[i];
+
+        ConfigFile config_file;
+        config_file.apply(&argc, &argv);
+
+        if (!parse_options(&argc, &argv))
+        {
+            cerr << "usage: " << argv[0] << " [--config <path>] [--cache-size <bytes>] [--associativity <ways>] [--line-size <bytes>] [--hit-latency <cycles>] [--mem-latency <cycles>] [--stats-json <path>] [--stats-csv <path>] tracefile" << endl;
+            return 1;
+        }
+
+        // What is left of the config file was not one of our options
+        for (int i = 1; i < argc; i++)
+        {
+            const char *origin = config_file.origin(argv[i]);
+            if (origin != NULL) throw invalid_argument(string(origin) + ": unknown option " + argv[i]);
+        }
+
         // Get the tracefile argument and create Tracefile object
         // This function sets tracefile_ptr and num_cpus
         init_tracefile(&argc, &argv);
@@ -746,7 +919,7 @@ int sc_main(int argc, char* argv[])
         // Signals
         sc_buffer<Cache::Function> *sigMemFunc = new sc_buffer<Cache::Function>[num_cpus];
         sc_buffer<Cache::RetCode>  *sigMemDone = new sc_buffer<Cache::RetCode>[num_cpus];
-        sc_signal<int>              *sigMemAddr = new sc_signal<int>[num_cpus];
+        sc_signal<addr_t>           *sigMemAddr = new sc_signal<addr_t>[num_cpus];
         sc_signal_rv<8>             *sigMemData = new sc_signal_rv<8>[num_cpus];
 
         // Signals Cache-Bus
@@ -820,6 +993,17 @@ int sc_main(int argc, char* argv[])
             cache[i]->Port_CLK(clk);
             cpu[i]->Port_CLK(clk);
         }
+
+        // Counters for the stats files
+        StatsExport stats;
+        stats.info("command", command);
+        for (int i = 0; i < num_cpus; i++)
+        {
+            char prefix[16];
+            sprintf(prefix, "cache.%d", i);
+            cache[i]->watch(stats, prefix);
+        }
+        bus.watch(stats);
         
         // Open VCD file
         //sc_trace_file *wf = sc_create_vcd_trace_file("final_cache");
@@ -835,8 +1019,13 @@ int sc_main(int argc, char* argv[])
 
         // Start Simulation
         sc_start();
+
+        long cycles = sc_time_stamp() / clk.period();
+        if (stats_json != NULL && !stats.write_json(stats_json, cycles)) cerr << "cannot write " << stats_json << endl;
+        if (stats_csv != NULL && !stats.write_csv(stats_csv, cycles)) cerr << "cannot write " << stats_csv << endl;
         
         // Print statistics after simulation finished
+        print_configuration();
         stats_print();
         bus.output();
         //sc_close_vcd_trace_file(wf);
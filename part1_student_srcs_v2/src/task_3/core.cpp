@@ -31,33 +31,197 @@
 */
 
 #include "aca2009.h"
+#include "host_profiler.h"
+#define LOG_SCOPE           ProfileScope log_scope(PROF_LOG)
+#include "../common/log.h"
+#include "../common/stats_export.h"
+#include "../common/live_counters.h"
+#include "stream_trace.h"
+#include "snoop_filter.h"
+#include "protocol.h"
+#include "sharing_profiler.h"
+#include "memctrl.h"
+#include "latency.h"
+#include "wave_tracer.h"
 #include <systemc.h>
 #include <iostream>
 #include <iomanip>
+#include <vector>
+#include <algorithm>
 
 using namespace std;
 
+/* Default cache geometry, see --cache-size, --associativity and
+   --line-size. The line size and the number of sets must be powers of two. */
+#ifndef MEM_SIZE
 #define MEM_SIZE            32768
+#endif
+#ifndef ASSOCIATIVITY
 #define ASSOCIATIVITY       8
+#endif
+#ifndef LINE_SIZE
 #define LINE_SIZE           32
-#define NUM_SETS            ( ( MEM_SIZE / LINE_SIZE ) / ASSOCIATIVITY )
+#endif
 
+/* Largest line size, line data is kept in arrays of this size. */
+#define MAX_LINE_SIZE       256
 
+/* Default cycles main memory needs to return a line. */
+#define MEM_LATENCY         100
 
-/* Bus interface, modified version from assignment. */
+/* Default cycles for a cache hit. */
+#define HIT_LATENCY         1
+
+/* Default cycles for a cache to supply a line to another cache. */
+#define C2C_LATENCY         20
+
+/* Width of addresses on the CPU ports and the bus. */
+#define ADDR_BITS           64
+
+/* Default bus data timing once it is modeled, see Bus::timing(): bytes per
+   beat, beats per burst and idle cycles after each burst before the bus
+   changes hands. */
+#define BUS_WIDTH           8
+#define BUS_BURST           4
+#define BUS_TURNAROUND      1
+
+/* Default cycles an atomic read-modify-write keeps its line locked. */
+#define RMW_CYCLES          2
+
+/* Default entries the out-of-order CPU dispatches and retires per cycle. */
+#define OOO_WIDTH           4
+
+/* Default accesses an out-of-order CPU keeps in flight. */
+#define OOO_LANES           4
+
+/* Default cycles between updates of the live counters. */
+#define LIVE_INTERVAL       10000
+
+typedef uint64_t addr_t;
+
+/* Number of bits needed to index n entries, n being a power of two. */
+static inline unsigned log2i(uint64_t n)
+{
+    unsigned bits = 0;
+    while (n > 1) {
+        n >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+
+
+/* Cache geometry in bytes, set by sc_main. */
+int cache_size = MEM_SIZE;
+int associativity = ASSOCIATIVITY;
+int line_size = LINE_SIZE;
+
+/* Replacement policies. Random only picks among the lines of a full set. */
+enum Replacement
+{
+    REPL_LRU,
+    REPL_FIFO,
+    REPL_RANDOM,
+};
+
+/* Default replacement policy, set by sc_main. */
+int replacement = REPL_LRU;
+
+/* Latencies in cycles, set by sc_main. */
+int mem_latency = MEM_LATENCY;
+int hit_latency = HIT_LATENCY;
+int rmw_cycles = RMW_CYCLES;
+
+/* Cycles for a cache to supply a line, set by sc_main. */
+int c2c_latency = C2C_LATENCY;
+
+/* Entries the out-of-order CPU dispatches and retires per cycle, set by
+   sc_main. */
+int ooo_width = OOO_WIDTH;
+
+/* Clock period, set by sc_main; latencies are counted in cycles. */
+sc_time cycle_time;
+
+/* Set by sc_main when the false-sharing report is requested. */
+SharingProfiler *sharing_ptr = NULL;
+
+/* Set by sc_main when a waveform is traced, misses may start the window. */
+WaveTracer *tracer_ptr = NULL;
+
+/* Set by sc_main to model DRAM timing instead of a fixed mem_latency. */
+MemoryController *memctrl_ptr = NULL;
+
+/* Read a line from main memory, or post a write-back to it. Reads return
+   once the line is there. */
+static void memory_access(addr_t addr, bool write)
+{
+    if (memctrl_ptr != NULL) memctrl_ptr->access(addr, write);
+    else if (!write) {
+        int region = HostProfiler::suspend();
+        wait(mem_latency);
+        HostProfiler::resume(region);
+    }
+}
+
+/* Data returned for a Rd or RdX. When a snooping cache supplies the line
+   it fills data and sets supplied, otherwise the line comes from memory.
+   An Upd carries the written word at its offset in data. */
+typedef struct {
+    bool supplied;
+    uint8_t data[MAX_LINE_SIZE];
+} line_data_t;
+
+/* Bus interface, modified version from assignment. Rd returns true when
+   another cache keeps a copy of the line. Upd sends a written word to the
+   other copies for the update protocols and returns true when a copy is
+   left. flush writes a dirty line back to memory. */
 class Bus_if : public virtual sc_interface
 {
     public:
-        virtual bool Rd(int writer, int addr) = 0;
-        virtual bool Upgr(int writer, int addr, int data) = 0;
-        virtual bool RdX(int writer, int addr) = 0;
-        virtual bool flush(int writer, int addr, uint8_t data[32]) = 0;
+        virtual bool Rd(int writer, addr_t addr, line_data_t &line) = 0;
+        virtual bool Upgr(int writer, addr_t addr, int data) = 0;
+        virtual bool RdX(int writer, addr_t addr, line_data_t &line) = 0;
+        virtual bool Upd(int writer, addr_t addr, int data) = 0;
+        virtual bool flush(int writer, addr_t addr, uint8_t data[MAX_LINE_SIZE]) = 0;
+};
+
+/* Snoop interface, every request on the bus is presented to all caches
+   through it. Returns true when the snooping cache keeps a copy. line is
+   NULL for requests without a data phase. holds tells whether the cache
+   has a valid copy of the line of addr. */
+class Snoop_if : public virtual sc_interface
+{
+    public:
+        virtual bool snoop(int writer, addr_t addr, int req, line_data_t *line) = 0;
+        virtual bool holds(addr_t addr) = 0;
+};
+
+/* Processor side of a cache for CPUs that keep several accesses
+   outstanding, each access runs in the calling thread. f is a
+   Cache::Function and the result a Cache::RetCode; data holds the byte to
+   write or receives the byte read. */
+class Mem_if : public virtual sc_interface
+{
+    public:
+        virtual int access(int f, addr_t addr, uint8_t &data) = 0;
+};
+
+/* What sc_main needs from any of the interconnect options. */
+class Interconnect : public Bus_if
+{
+    public:
+        /* Deliver snoops to cache. Caches are attached in cache_id order. */
+        virtual void attach(Snoop_if &cache) = 0;
+        virtual void output(const sc_time &cycle) = 0;
+        /* Register the counters for the stats files. */
+        virtual void watch(StatsExport &stats) = 0;
 };
 
 
 
 
-SC_MODULE(Cache)
+class Cache : public Snoop_if, public Mem_if, public ProfiledModule
 {
 
  //sc_inout< sc_uint<8> > bus;
@@ -67,6 +231,9 @@ public:
     {
         FUNC_READ,
         FUNC_WRITE,
+        FUNC_RMW,       // atomic read-modify-write
+        FUNC_LL,        // load-linked
+        FUNC_SC,        // store-conditional
     };
 
     enum BusRequest{
@@ -75,99 +242,226 @@ public:
         BUS_READX,
         BUS_FREE,
         FLUSH,
+        BUS_INVAL,      // back-invalidation from a snoop filter
+        BUS_UPD,
     };
 
     enum RetCode
     {
         RET_READ_DONE,
         RET_WRITE_DONE,
+        RET_SC_FAILED,
     };
 
-     /* Five states for MOESI protocol. */
-    enum Line_State
-    {
-        invalid,
-        exclusive,
-        modified,
-        owned,
-        shared,
-    };
+    /* Line states of the selected coherence protocol. */
+    typedef Protocol::State Line_State;
 
     sc_in<bool>     Port_CLK;
     sc_in<Function> Port_Func;
-    sc_in<int>      Port_Addr;
+    sc_in<addr_t>   Port_Addr;
     sc_out<RetCode> Port_Done;
     sc_inout_rv<8>  Port_Data;
 
-    sc_out<uint8_t> Set_No;
+    sc_out<uint32_t> Set_No;
     sc_out<uint8_t> Line_No;
     sc_out<bool>    Hit_Point;
     sc_out<bool>    Write_Read;
 
 
-    /* Bus snooping ports. */
-    sc_in_rv<32>    Port_BusAddr;
-    sc_in<int>      Port_BusWriter;
-    sc_in<int> 		  Port_BusReq;
-  //  sc_in_rv<32*8>  Port_BusData;
     /* Bus requests ports. */
     sc_port<Bus_if> Port_Bus;
 
     /* Variables. */
     int cache_id;
-    int probeRead;
-    int probeWrite;
+    long probeRead;
+    long probeWrite;
+    long probe_hits;        // snoops that found the line
+
+    /* Hits and misses, in total and per set. */
+    long read_hits;
+    long read_misses;
+    long write_hits;
+    long write_misses;
+    std::vector<long> set_hits;
+    std::vector<long> set_misses;
+
+    /* Line state changes of accesses and snoops, from * NUM_STATES + to. */
+    std::vector<long> transitions;
+
+    /* Cycles from request to answer, by write and the bus action taken. */
+    LatencyHistogram latency[2][Protocol::NUM_ACTIONS];
+
+    /* Coherence protocol, MOESI unless sc_main selects another one. */
+    const Protocol *protocol;
+
+    /* Atomics. */
+    long rmws;
+    long lls;
+    long scs;
+    long sc_failures;
+    long rmw_stalls;        // cycles snoops waited for an RMW in progress
+
+    /* Cycles accesses waited for another access to the same line. */
+    long mshr_waits;
 
     SC_CTOR(Cache)
     {
         cache_id = 0;
-        SC_THREAD(bus); //*********************** thread for bus
+        probeRead = 0;
+        probeWrite = 0;
+        probe_hits = 0;
+        read_hits = 0;
+        read_misses = 0;
+        write_hits = 0;
+        write_misses = 0;
+        transitions.assign(Protocol::NUM_STATES * Protocol::NUM_STATES, 0);
+        protocol = &Protocol::get("moesi");
+        rmws = 0;
+        lls = 0;
+        scs = 0;
+        sc_failures = 0;
+        rmw_stalls = 0;
+        mshr_waits = 0;
+        reserved = false;
+        locked = false;
+        seed = 0;
         SC_THREAD(execute);
         sensitive << Port_CLK.pos();
         dont_initialize();
 
-        cache = new cache_line_t[NUM_SETS][ASSOCIATIVITY];
+        configure(cache_size, associativity, replacement, hit_latency);
     }
 
-    ~Cache()
+    /* Give this cache its own geometry, e.g. for the cores of a class. The
+       line size is shared by all caches. Call before the simulation. */
+    void configure(int size, int ways, int policy, int hit_cycles)
     {
-        delete[] cache;
+        this->size = size;
+        this->ways = ways;
+        this->policy = policy;
+        this->hit_cycles = hit_cycles;
+
+        num_sets = size / line_size / ways;
+        offset_bits = log2i(line_size);
+        set_bits = log2i(num_sets);
+
+        cache.assign(num_sets, vector<cache_line_t>(ways));
+        set_hits.assign(num_sets, 0);
+        set_misses.assign(num_sets, 0);
+    }
+
+    /* Whether a cache of size bytes with ways ways can be built with the
+       line size set by sc_main. Ages are kept in a byte, see update_LRU(). */
+    static bool valid_geometry(int size, int ways)
+    {
+        int sets = ways > 0 && line_size > 0 ? size / line_size / ways : 0;
+        return ways <= 255 && line_size <= MAX_LINE_SIZE && sets > 0 &&
+               sets * line_size * ways == size &&
+               (line_size & (line_size - 1)) == 0 && (sets & (sets - 1)) == 0;
+    }
+
+    int size;
+    int ways;
+    int policy;             // Replacement
+    int hit_cycles;
+
+    /* sc_main has set cache_id by now, every cache gets its own sequence
+       of random victims. */
+    virtual void end_of_elaboration()
+    {
+        seed = cache_id;
+    }
+
+    void watch(StatsExport &stats, const string &prefix)
+    {
+        stats.counter(prefix + ".read_hits", &read_hits);
+        stats.counter(prefix + ".read_misses", &read_misses);
+        stats.counter(prefix + ".write_hits", &write_hits);
+        stats.counter(prefix + ".write_misses", &write_misses);
+        stats.counter(prefix + ".probe_reads", &probeRead);
+        stats.counter(prefix + ".probe_writes", &probeWrite);
+        stats.counter(prefix + ".probe_hits", &probe_hits);
+        stats.counter(prefix + ".rmws", &rmws);
+        stats.counter(prefix + ".sc_failures", &sc_failures);
+        stats.counters(prefix + ".set_hits", &set_hits);
+        stats.counters(prefix + ".set_misses", &set_misses);
+        stats.counters(prefix + ".transitions", &transitions);
     }
 
 private:
 
-    typedef union {
-        struct {
-            uint32_t offset: 5;
-            uint32_t set: 7;
-            uint32_t tag: 20;
-        };
-        uint32_t addr;
+    /* Address split into offset, set and tag for this cache's geometry. */
+    typedef struct {
+        addr_t addr;
+        uint32_t offset;
+        uint32_t set;
+        uint64_t tag;
     } mem_addr_t;
 
     typedef struct cache_line{
-        cache_line() : state(invalid) {}
+        cache_line() : state(Protocol::I), age(0), busy(false), tag(0) {}
         Line_State state;
         uint8_t age;
-        uint32_t tag;
-        uint8_t data[32];
+        bool busy;              // used by an access in progress, not replaced
+        uint64_t tag;
+        uint8_t data[MAX_LINE_SIZE];
     } cache_line_t;
 
-    cache_line_t (*cache)[ASSOCIATIVITY];
+    vector< vector<cache_line_t> > cache;
+    int num_sets;
+    unsigned seed;          // for random replacement
+
+    unsigned offset_bits;
+    unsigned set_bits;
+
+    /* Load-linked reservation, lost when the line is written elsewhere
+       or evicted. */
+    bool reserved;
+    uint64_t reserved_line;
+
+    /* Line held by an RMW in progress, snoops to it wait. */
+    bool locked;
+    uint64_t locked_line;
+
+    /* Lines with an access in progress. */
+    std::vector<uint64_t> pending;
+
+    static bool is_write(Function f)
+    {
+        return f == FUNC_WRITE || f == FUNC_RMW || f == FUNC_SC;
+    }
+
+    mem_addr_t decode(addr_t addr) const {
+        mem_addr_t mem_addr;
+        mem_addr.addr = addr;
+        mem_addr.offset = addr & (line_size - 1);
+        mem_addr.set = (addr >> offset_bits) & (num_sets - 1);
+        mem_addr.tag = addr >> (offset_bits + set_bits);
+        return mem_addr;
+    }
 
-    uint8_t get_LRU_line(uint8_t set) {
+    /* Line of set to replace, among the ones no access in progress uses.
+       There must be one. */
+    uint8_t get_LRU_line(uint32_t set) {
 
-        for (int i = 0; i < ASSOCIATIVITY; i++){
+        for (int i = 0; i < ways; i++){
 
             //If a line hasn't been used yet, use it
-            if (cache[set][i].age == 0) return i;
+            if (cache[set][i].age == 0 && !cache[set][i].busy) return i;
 
         }
 
+        if (policy == REPL_RANDOM) {
+            int i;
+            do i = rand_r(&seed) % ways; while (cache[set][i].busy);
+            return i;
+        }
+
         uint8_t highest_age = 0;
-        uint8_t LRU_line;
+        uint8_t LRU_line = 0;
 
-        for (int i = 0; i < ASSOCIATIVITY; i++){
+        for (int i = 0; i < ways; i++){
+            if (cache[set][i].busy) continue;
             if (cache[set][i].age > highest_age) {
                 highest_age = cache[set][i].age;
                 LRU_line = i;
@@ -176,7 +470,7 @@ private:
         return LRU_line;
     }
 
-    void update_LRU(uint8_t set, uint8_t MRU_line) {
+    void update_LRU(uint32_t set, uint8_t MRU_line) {
 
         //The line was already the most recently used, nothing to be done
         if (cache[set][MRU_line].age == 1) return;
@@ -188,7 +482,7 @@ private:
         cache[set][MRU_line].age = 1;
 
 		if (previous_age == 0) {
-			for (int i = 0; i < ASSOCIATIVITY; i++) {
+			for (int i = 0; i < ways; i++) {
 				//A cache line's age shouldn't be increased if:
 				//- the line is empty
 				//- the line is the one that we just used
@@ -197,7 +491,7 @@ private:
 			}
 		}
 		else {
-			for (int i = 0; i < ASSOCIATIVITY; i++){
+			for (int i = 0; i < ways; i++){
 				//A cache line's age shouldn't be increased if:
 				//- the line is empty
 				//- the line is the one that we just used
@@ -208,569 +502,1153 @@ private:
 		}
     }
 
-    /* Thread that handles the bus. */
-    void bus()
-    {
-        int br;
-        mem_addr_t mem_addr;
-        int writer;
-        int probeRead = 0;
-        int probeWrite = 0;
-        /* Continue while snooping is activated. */
-        cout << "core " << cache_id << " begins to snoop" <<endl;
+    /* Put a fetched line in the LRU line of its set, writing the victim
+       back first when it is dirty. The line is held for the access until
+       perform() is done with it, so other accesses in flight neither pick
+       nor evict it. Returns the line used. */
+    uint8_t replace(const mem_addr_t &mem_addr, const line_data_t &fill) {
+        while (!free_line(mem_addr.set)) wait();
 
-        while(true)
+        uint8_t target_line = get_LRU_line(mem_addr.set);
+        cache_line_t &line = cache[mem_addr.set][target_line];
+        line.busy = true;
+
+        addr_t victim = (line.tag << (offset_bits + set_bits)) | ((addr_t)mem_addr.set << offset_bits);
+        if (line.state != Protocol::I && reserved && reserved_line == victim / line_size) reserved = false;
+
+        if (Protocol::dirty(line.state))
         {
-                        /* Wait for work. */
-            wait(Port_BusReq.value_changed_event());
+            Port_Bus->flush(cache_id, victim, line.data);
+        }
 
-            br = Port_BusReq.read();
+        // invisible to snoops until perform() gives it its state
+        line.tag = mem_addr.tag;
+        line.state = Protocol::I;
+        if (fill.supplied) {
+            memcpy(line.data, fill.data, line_size);
+        }
+        else {
+            // Replace data with something from RAM
+            for (int i = 0; i < line_size; i++) line.data[i] = (uint8_t)(rand() % 255);
+        }
+        return target_line;
+    }
 
-            if (br == BUS_FREE) {
-            	cout << "The bus is free!" << endl;
-            	continue;
-            }
+    /* Whether set has a line no access in progress uses. */
+    bool free_line(uint32_t set) const {
+        for (int i = 0; i < ways; i++) {
+            if (!cache[set][i].busy) return true;
+        }
+        return false;
+    }
+
+public:
+    /* Called by the bus for every request on it. */
+    virtual bool snoop(int writer, addr_t addr, int br, line_data_t *data)
+    {
+        ProfileScope scope(PROF_SNOOP);
+        mem_addr_t mem_addr = decode(addr);
+        Protocol::Event event;
+
+        // check if I am the requestor?
+        if (writer == cache_id) return false;
+
+        LOG_TRACE("-------------------------------------------\n"
+                  "BUS EXECUTES A REQUEST\n"
+                  "cache_id:             " << cache_id << "\n"
+                  "bus event changes at: " << sc_time_stamp() << "\n"
+                  "the writer core is :  " << writer << "\n"
+                  "target address:       " << mem_addr.addr << "\n"
+                  "bus request:          " << br << " ( 0: BUS_READ; 1: BUS_UPGR; 2: BUS_READX; 3: BUS_FREE)");
+
+        switch(br)
+        {
+            case BUS_READ:
+              probeRead++;
+              event = Protocol::BUS_RD;
+              break;
+
+            case BUS_UPGR:
+              probeWrite++;
+              event = Protocol::BUS_UPGR;
+              break;
+
+            // the difference of READX and WRITE is just the probe counter.
+            case BUS_READX:
+              probeRead++;
+              event = Protocol::BUS_RDX;
+              break;
+
+            case BUS_INVAL:
+              event = Protocol::BUS_RDX;
+              break;
+
+            case BUS_UPD:
+              probeWrite++;
+              event = Protocol::BUS_UPD;
+              break;
+
+            default:
+              cerr << "cannot check the bus request! bus function is wrong!! checkout the bus!!"<< "at: " << sc_time_stamp() << endl;
+              return false;
+        }
 
-                /* preparation for bus work*/
-            mem_addr.addr = Port_BusAddr.read().to_int();
-            writer = Port_BusWriter.read();
+        // an RMW in progress holds on to its line
+        while (locked && locked_line == addr / line_size)
+        {
+            rmw_stalls++;
+            wait();
+        }
 
-            cout << "-------------------------------------------"<< endl;
-            cout << "BUS EXECUTES A REQUEST" << endl;
-            cout << "cache_id:             " << cache_id <<endl;
-            cout << "bus event changes at: " << sc_time_stamp() << endl;
-            cout << "the writer core is :  " << writer <<endl;
-            cout << "target address:       " << mem_addr.addr  <<endl;
-            cout << "bus request:          " << br  << " ( 0: BUS_READ; 1: BUS_UPGR; 2: BUS_READX; 3: BUS_FREE)"<< endl;
+        for ( int i=0; i< ways;i++)
+        {
+            cache_line_t &line = cache[mem_addr.set][i];
 
-            /* Possibilities. */
+            if (line.tag != mem_addr.tag || line.state == Protocol::I) continue;
 
-            // check if I am the requestor?
-            if(writer != cache_id)
+            bool dirty = Protocol::dirty(line.state);
+            const Protocol::transition_t &t = protocol->lookup(line.state, event);
+            LOG_TRACE("line state:           " << Protocol::state_name(line.state) << "  ->  " << Protocol::state_name(t.next)
+                      << " in line " << i << " of set " << mem_addr.set);
+            LOG_RECORD(sc_time_stamp().value(), EV_SNOOP, cache_id, addr, br << 16 | line.state << 8 | t.next);
+            if (sharing_ptr != NULL && writer >= 0)
             {
+                if (event == Protocol::BUS_UPD) sharing_ptr->updated(cache_id, writer, addr);
+                else if (t.next == Protocol::I) sharing_ptr->invalidated(cache_id, writer, addr);
+            }
+            transitions[line.state * Protocol::NUM_STATES + t.next]++;
+            probe_hits++;
+            line.state = (Line_State)t.next;
 
-                switch(br)
-                {
-                    case BUS_READ:
-                     // nothing special needed to be done
-                    	for ( int i=0; i< ASSOCIATIVITY;i++)
-                      {
-                          if (cache[mem_addr.set][i].tag == mem_addr.tag)
-                          {
-                              if (cache[mem_addr.set][i].state == modified || cache[mem_addr.set][i].state == exclusive || cache[mem_addr.set][i].state == owned)
-                              {
-                                cache[mem_addr.set][i].state == owned;
-                                // flush the cache block to requesting core
-                                Port_Bus->flush(cache_id, mem_addr.addr, cache[mem_addr.set][i].data);
-                              //  probeRead++;
-                              //  cout << "BUS READ:             " << probeRead  << endl;
-                              }
-                          	}
-                        }
-                      break;
-
-                    case BUS_UPGR:
-                      for ( int i=0; i< ASSOCIATIVITY;i++)
-                      {
-                          if (cache[mem_addr.set][i].tag == mem_addr.tag)
-                          {
-                              if (cache[mem_addr.set][i].state == invalid || cache[mem_addr.set][i].state == shared || cache[mem_addr.set][i].state == owned)
-                              {
-                                cache[mem_addr.set][i].state == invalid;
-                                //  probeWrite++;
-                                //  cout << "BUS WRITE:            " << probeWrite  << endl;
-                                cout << "BUS UPGR: invalidate cache:" <<  i << "in the set of "<< mem_addr.set  <<  endl;
-                              }
-                          }
-                      }
-                      break;
-
-                    // the difference of READX and WRITE is just the probe counter.
-
-                    // NOTE: invalidate other copies
-                    case BUS_READX:
-                      for ( int i=0; i< ASSOCIATIVITY;i++)
-                      {
-                        if (cache[mem_addr.set][i].tag == mem_addr.tag)
-                        {
-                          cache[mem_addr.set][i].state == invalid;
-                          cout << "BUS READX: invalidate cache:" <<  i << "in the set of "<< mem_addr.set  <<  endl;
-
-                          if (cache[mem_addr.set][i].state == exclusive || cache[mem_addr.set][i].state == modified || cache[mem_addr.set][i].state == owned)
-                          {
-                             Port_Bus->flush(cache_id, mem_addr.addr, cache[mem_addr.set][i].data);
-                            // probeRead++;
-                            // cout << "BUS READX:            " << probeRead << "th time at:" << sc_time_stamp() << endl;
-                          }
-                        }
-                      }
-                      break;
-
-                    case FLUSH:
-                      break;
+            // another cache wrote the line, the reservation is lost
+            if (reserved && reserved_line == addr / line_size && (t.next == Protocol::I || event == Protocol::BUS_UPD))
+            {
+                reserved = false;
+            }
 
-                    case BUS_FREE:
-                    	break;
+            // update protocols: take the written word
+            if (event == Protocol::BUS_UPD) line.data[mem_addr.offset] = data->data[mem_addr.offset];
 
-                    default:
-                        cout << "cannot check the bus request! bus function is wrong!! checkout the bus!!"<< "at: " << sc_time_stamp() << endl;
-                        break;
-                }
+            // intervention: supply the line instead of memory; a
+            // back-invalidation takes a dirty line for its write-back
+            if ((br == BUS_INVAL ? dirty : t.supply) && data != NULL && !data->supplied)
+            {
+                memcpy(data->data, line.data, line_size);
+                data->supplied = true;
             }
 
+            // the line stays here unless the request invalidated it
+            return line.state != Protocol::I;
+        }
+
+        return false;
+    }
+
+    virtual bool holds(addr_t addr)
+    {
+        mem_addr_t mem_addr = decode(addr);
 
+        for (int i = 0; i < ways; i++)
+        {
+            const cache_line_t &line = cache[mem_addr.set][i];
+            if (line.tag == mem_addr.tag && line.state != Protocol::I) return true;
         }
+        return false;
     }
 
+    virtual int access(int f, addr_t addr, uint8_t &data)
+    {
+        return access((Function)f, addr, data, false);
+    }
 
+private:
     void execute() {
 
-        mem_addr_t mem_addr;
-        bool hit;
-        Line_State ls = invalid;
-        uint8_t data = 0;
-        uint8_t target_line = 0;
+        ProfileScope scope(PROF_CACHE);
+        uint8_t data;
         while (true)
         {
             wait(Port_Func.value_changed_event());  // this is fine since we use sc_buffer
-            cout << "_____________________ debug line 1 ________________ " << endl;
             Function f = Port_Func.read();
-            mem_addr.addr = Port_Addr.read();
 
+            data = is_write(f) ? (uint8_t)Port_Data.read().to_int() : 0;
+            RetCode ret = access(f, Port_Addr.read(), data, true);
 
-            cout << "@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@"<< endl;
-            cout << "PROCESSOR PERFORMS A WRITE/READ FUNCTION"<< endl;
-            cout << "cache_id:           " << cache_id << endl;
-            cout << "targeting address:  " << mem_addr.addr <<endl;
+            if (ret == RET_READ_DONE)
+            {
+                //Return the cache line
+                Port_Data.write(data);
+                Port_Done.write( RET_READ_DONE );
+                wait();
+                Port_Data.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+            }
+            else
+            {
+                Port_Done.write( ret );
+            }
+        }
+    }
 
-            if(f == FUNC_WRITE) Write_Read = true;
-            else if(f == FUNC_READ) Write_Read = false;
+    /* One access of the CPU, returns when it is done. Accesses to a line
+       that is already being accessed wait for it, like a miss merging into
+       an MSHR. The waveform ports are only driven for the signal port. */
+    RetCode access(Function f, addr_t addr, uint8_t &data, bool waveform)
+    {
+        ProfileScope scope(PROF_CACHE);
+        sc_time start = sc_time_stamp();
+        int action = Protocol::NONE;
+        uint64_t line = addr / line_size;
+        while (std::find(pending.begin(), pending.end(), line) != pending.end())
+        {
+            mshr_waits++;
+            wait();
+        }
 
-            hit = false;
-            // First determine hit or miss
+        pending.push_back(line);
+        mem_addr_t mem_addr = decode(addr);
+        int way = -1;
+        RetCode ret = perform(f, mem_addr, data, waveform, action, way);
+        if (way >= 0) cache[mem_addr.set][way].busy = false;
+        pending.erase(std::find(pending.begin(), pending.end(), line));
 
-            for (int i = 0; i < ASSOCIATIVITY; i++) {
-                if (cache[mem_addr.set][i].tag == mem_addr.tag && cache[mem_addr.set][i].state != invalid) {
-                    hit = true;
-                    target_line = i;
+        latency[is_write(f)][action].add((long)((sc_time_stamp() - start) / cycle_time + 0.5));
+        return ret;
+    }
 
-                    ls = cache[mem_addr.set][i].state;
-                }
+    /* The access itself. way is set to the line it holds, see replace(). */
+    RetCode perform(Function f, const mem_addr_t &mem_addr, uint8_t &data, bool waveform, int &action, int &way) {
+
+        bool hit;
+        bool copies;
+        Line_State ls;
+        Line_State next;
+        uint8_t target_line = 0;
+        line_data_t fill;
+        static const char *func_names[] = { "FUNC_READ", "FUNC_WRITE", "FUNC_RMW", "FUNC_LL", "FUNC_SC" };
+        bool write = is_write(f);
+
+
+        LOG_TRACE("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n"
+                  "PROCESSOR PERFORMS A WRITE/READ FUNCTION\n"
+                  "cache_id:           " << cache_id << "\n"
+                  "targeting address:  " << mem_addr.addr << "\n"
+                  "function:           " << func_names[f]);
+
+        if (waveform) Write_Read = write;
+
+        if (f == FUNC_RMW) rmws++;
+        else if (f == FUNC_LL) lls++;
+        else if (f == FUNC_SC) {
+            scs++;
+            // fails without bus traffic once the reservation is gone
+            if (!reserved || reserved_line != mem_addr.addr / line_size) {
+                sc_failures++;
+                LOG_TRACE("store-conditional failed");
+                wait(hit_cycles);
+                return RET_SC_FAILED;
             }
-            Hit_Point = hit;
-            cout << "line state:         " << ls << "  [ 0: invalid; 1: exclusive, 2: modified, 3: owned, 4: shared]"  << endl;
-            // FUNC_WRITE:
-            // - If hit:    update the cache line
-            //              invalidate other copies     BUS_WRITE
-            //              update the LRU indices
-            // - If miss:   determine LRU cache line
-            //              set the valid bit
-            //              invalidate other copies     BUS_READX
-            //              write it back to RAM if line is valid (wait 100 cycles)
-            //              replace data (wait 100 cycles)
-            //              write new data
-            //              update the LRU indices
-
-            if (f == FUNC_WRITE) {
-                cout << "function:          " << " FUNC_WRITE "  << endl;
-                data = (uint8_t)Port_Data.read().to_int();
-
-                switch (ls) {
-                  case modified:
-                    // no bus request is sent in modified case
-                    // line state NOT changing
-                    stats_writehit(cache_id);
-
-                    cout << "line state:         "<< "Modified  ->  Modified  " << endl;
-                    //Update the cache line
-                    cache[mem_addr.set][target_line].data[mem_addr.offset] = data;
-                    //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
-
-                    Set_No = mem_addr.set;
-                    Line_No = target_line;
-                //    cout << "_____________________ debug line 1 ________________ " << endl;
-                    //  do not write through to memory
-                    // wait(100);
-                    break;
+        }
 
-                  case owned:
-                   // NOTE: Send BUS_UPGR to bus to make other copies in shared state
-                    stats_writehit(cache_id);
-                    cout << "line state:         "<< "Owned  ->  Modified  "  << endl;
-                    Port_Bus->Upgr(cache_id, mem_addr.addr, data);
-                    //Update the cache line
-                    cache[mem_addr.set][target_line].data[mem_addr.offset] = data;
-                    //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
-                    cache[mem_addr.set][target_line].state = modified;
-
-                    Set_No = mem_addr.set;
-                    Line_No = target_line;
-                    // do not write through to memory
-                    break;
+        if (sharing_ptr != NULL) sharing_ptr->access(cache_id, mem_addr.addr, write);
 
-                  case exclusive:
-                    // no bus request is sent in exclusive case
-                    stats_writehit(cache_id);
-                    cout << "line state:         "<< "exclusive  ->  Modified  "  << endl;
-                    //Update the cache line
-                    cache[mem_addr.set][target_line].data[mem_addr.offset] = data;
-                    //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
-                    cache[mem_addr.set][target_line].state = modified;
-
-                    Set_No = mem_addr.set;
-                    Line_No = target_line;
-                    //Update the cache line
-                    break;
+        hit = false;
+        // First determine hit or miss
 
-                  case shared:
-                    stats_writehit(cache_id);
-                    cout << "line state:         "<< "shared  ->  Modified  "  << endl;
-                  // NOTE: send BUS_UPGR to bus to  invalidate other copies
-                    Port_Bus->Upgr(cache_id, mem_addr.addr, data);
-                    //Update the cache line
-                    cache[mem_addr.set][target_line].data[mem_addr.offset] = data;
-                    //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
-                    cache[mem_addr.set][target_line].state = modified;
-
-                    Set_No = mem_addr.set;
-                    Line_No = target_line;
-                    break;
+        ls = Protocol::I;
+        for (int i = 0; i < ways; i++) {
+            if (cache[mem_addr.set][i].tag == mem_addr.tag && cache[mem_addr.set][i].state != Protocol::I) {
+                hit = true;
+                target_line = i;
+                // an Upgr or an RMW waits before it uses the line
+                cache[mem_addr.set][i].busy = true;
+                way = i;
 
-                  case invalid:
-                    stats_writemiss(cache_id);
-                    cout << "line state:         "<< "invalid  ->  Modified  " << endl;
-                  // NOTE: send BUS_READX to bus to invalidate copies
-                    Port_Bus->RdX(cache_id,mem_addr.addr);
-                    data = (uint8_t)(rand() % 255);
-                    wait(100);
-                    //Determine LRU line
-                    target_line = get_LRU_line((uint8_t)mem_addr.set);
-                    //Read new line from RAM (wait 100 cycles)
-                    for (int i = 0; i < LINE_SIZE; i++) cache[mem_addr.set][target_line].data[i] = (uint8_t)(rand() % 255);
-                    wait(100);
-                    //Write new data in LRU line
-                    cache[mem_addr.set][target_line].tag = mem_addr.tag;
-                    cache[mem_addr.set][target_line].data[mem_addr.offset] = data;
-                    //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
-                    cache[mem_addr.set][target_line].state = modified;
-
-                    Line_No = target_line;
-                    Set_No = mem_addr.set;
-                    break;
+                ls = cache[mem_addr.set][i].state;
+                break;
+            }
+        }
+        if (waveform) Hit_Point = hit;
+        if (!hit && tracer_ptr != NULL) tracer_ptr->miss(mem_addr.addr / line_size);
+        LOG_RECORD(sc_time_stamp().value(), write ? EV_WRITE : EV_READ, cache_id, mem_addr.addr, hit);
+
+        if (write) {
+            if (hit) stats_writehit(cache_id);
+            else stats_writemiss(cache_id);
+            (hit ? write_hits : write_misses)++;
+        }
+        else {
+            if (hit) stats_readhit(cache_id);
+            else stats_readmiss(cache_id);
+            (hit ? read_hits : read_misses)++;
+        }
+        (hit ? set_hits : set_misses)[mem_addr.set]++;
+
+        // The protocol decides on the bus transaction and the next state
+        const Protocol::transition_t *t = &protocol->access(ls, write);
+        bool lost;
+        do {
+            next = (Line_State)t->next;
+            action = t->action;
+            lost = false;
+
+            switch (t->action) {
+              case Protocol::ISSUE_UPGR:
+                // invalidate the other copies, no data phase
+                Port_Bus->Upgr(cache_id, mem_addr.addr, data);
+                lost = cache[mem_addr.set][target_line].state == Protocol::I;
+                break;
 
-                  default:
-                    // NOTE: it should never happen
-                    cout << "something wrong when the processor issues a PrWirte" << endl;
-                    break;
+              case Protocol::ISSUE_RD:
+              case Protocol::ISSUE_RD_UPD:
+                // the bus returns once the line has been fetched
+                copies = Port_Bus->Rd(cache_id, mem_addr.addr, fill);
+                if (copies) next = (Line_State)t->next_shared;
+
+                target_line = replace(mem_addr, fill);
+                way = target_line;
+
+                // write miss on a shared line in an update protocol, the
+                // line is ours before the word goes out
+                if (copies && t->action == Protocol::ISSUE_RD_UPD) {
+                    cache[mem_addr.set][target_line].state = next;
+                    Port_Bus->Upd(cache_id, mem_addr.addr, data);
+                    lost = cache[mem_addr.set][target_line].state == Protocol::I;
                 }
-                Port_Done.write( RET_WRITE_DONE );
-                cout << "_____________________ debug line 2 ________________ " << endl;
+                break;
+
+              case Protocol::ISSUE_UPD:
+                // send the word to the other copies
+                copies = Port_Bus->Upd(cache_id, mem_addr.addr, data);
+                if (copies) next = (Line_State)t->next_shared;
+                lost = cache[mem_addr.set][target_line].state == Protocol::I;
+                break;
+
+              case Protocol::ISSUE_RDX:
+                // invalidate the other copies and fetch the line
+                Port_Bus->RdX(cache_id, mem_addr.addr, fill);
+
+                target_line = replace(mem_addr, fill);
+                way = target_line;
+                break;
+
+              default:
+                // hit that needs no bus transaction
+                break;
             }
-            // FUNC_READ:
-            // - If hit:    return the cache line
-            //              update the LRU indices
-            //              no bus request is sent
-            // - If miss:   determine LRU cache line
-            //              valid the cach line                BUS_READ
-            //              write it back to RAM
-            //              replace data with some random data (wait 100 cycles)
-            //              return the cache line
-            //              update the LRU indices
-
-            if (f == FUNC_READ) {
-
-                cout << "function:           " << "FUNC_READ" <<   endl;
-
-                switch (ls) {
-                  case modified:
-                  // no bus request is sent in modified case
-
-                  case owned:
-                  // no bus request is sent in owned case
-
-                  case exclusive:
-                  // no bus request is sent in exclusive case
-
-                  case shared:
-                  // no bus request is sent in shared case
-                    stats_readhit(cache_id);
-                    cout << "line state:         "<< "line state unchanged  ->  Shared  " << endl;
-                    Port_Data.write(cache[mem_addr.set][target_line].data[mem_addr.offset]);
-                    wait(1);
-                    //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
-                    Set_No = mem_addr.set;
-                    Line_No = target_line;
-                    break;/* value */
-
-                  case invalid:
-                  //NOTE: a BUS_READ is sent bus to fetch data
-                    cout << "line state:         "<< "Invalid  ->  exclusive or shared "  << endl;
-                    Port_Bus->Rd(cache_id, mem_addr.addr);
-                    //Determine LRU line
-                    target_line = get_LRU_line((uint8_t)mem_addr.set);
-                    Line_No = target_line;
-                    Set_No = mem_addr.set;
-                    //cout<<"Miss Line Number: "<<unsigned(target_line)<<endl;
-
-                    //Write back to RAM
-                    //if (cache[mem_addr.set][target_line].dirty) wait(100);
-
-                    if (Port_BusReq.read() == FLUSH){
-                      // get flushed with the data from other core
-                    //  cache[mem_addr.set][target_line].data = Port_BusData.read();
-                      cache[mem_addr.set][target_line].state = shared;
-                    }
-                    else{
-                      //Replace data with something from RAM
-                      cache[mem_addr.set][target_line].tag = mem_addr.tag;
-                      for (int i = 0; i < LINE_SIZE; i++)
-                      {
-                        cache[mem_addr.set][target_line].data[i] = (uint8_t)(rand() % 255);
-                      }
-                      cache[mem_addr.set][target_line].state = exclusive;
-                    }
 
-                    wait(100);
+            // A snoop took the line while the request waited for the bus,
+            // which then dropped the request: start over as a miss
+            if (lost) {
+                LOG_TRACE("line lost while waiting for the bus, reissued");
+                cache[mem_addr.set][target_line].busy = false;
+                way = -1;
+                hit = false;
+                ls = Protocol::I;
+                t = &protocol->access(ls, write);
+            }
+        } while (lost);
 
-                    //Return the cache line
-                    Port_Data.write(cache[mem_addr.set][target_line].data[mem_addr.offset]);
+        // the reservation was lost while the bus transaction was pending
+        if (f == FUNC_SC && !reserved) {
+            sc_failures++;
+            LOG_TRACE("store-conditional failed");
+            return RET_SC_FAILED;
+        }
 
-                    //Update LRU indices
-                    update_LRU((uint8_t)mem_addr.set, target_line);
+        LOG_TRACE("line state:         " << Protocol::state_name(ls) << "  ->  " << Protocol::state_name(next));
+        cache[mem_addr.set][target_line].state = next;
+        transitions[ls * Protocol::NUM_STATES + next]++;
 
-                    break;
+        //Update LRU indices, FIFO only ages lines when one is filled
+        if (policy != REPL_FIFO || !hit) update_LRU(mem_addr.set, target_line);
+        if (waveform) {
+            Set_No = mem_addr.set;
+            Line_No = target_line;
+        }
 
-                  default:
-                    // NOTE: it should never happen
-                    cout << "something wrong when the processor issues a PrRead" << endl;
-                    break;
-                }
-                Port_Done.write( RET_READ_DONE );
-                wait();
-                Port_Data.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+        if (write) {
+            if (f == FUNC_RMW) {
+                // hold the line for the read-modify-write
+                locked = true;
+                locked_line = mem_addr.addr / line_size;
+                wait(rmw_cycles);
+                locked = false;
             }
-            cout << "_____________________ debug line 3 ________________ " << endl;
+            if (f == FUNC_SC) reserved = false;
+
+            //Update the cache line, never written through to memory
+            cache[mem_addr.set][target_line].data[mem_addr.offset] = data;
+            // the CPU holds the data for a cycle before it waits for us
+            if (hit) wait(hit_cycles);
+            return RET_WRITE_DONE;
+        }
+
+        if (f == FUNC_LL) {
+            reserved = true;
+            reserved_line = mem_addr.addr / line_size;
         }
-          cout << "_____________________ debug line 4 ________________ " << endl;
-    }
 
+        data = cache[mem_addr.set][target_line].data[mem_addr.offset];
+        if (hit) wait(hit_cycles);
+        return RET_READ_DONE;
+    }
 
 };
 
-SC_MODULE(CPU)
+/* Set by sc_main when the trace is streamed instead of read by aca2009. */
+StreamTrace *streamtrace_ptr = NULL;
+
+/* Number of CPUs still working through the trace. */
+int cpus_running = 0;
+
+/* Trace entries fetched by all CPUs, for the host profile. */
+long trace_entries = 0;
+
+/* CPU driving one cache with a trace. By default every access blocks until
+   the cache is done. With a store buffer, writes retire into a FIFO that
+   drains to the cache in order while the CPU continues (TSO): loads bypass
+   the buffered stores and take the data of the youngest buffered store to
+   the same address. Fences and atomics wait for the buffer to drain.
+
+   Out of order, the CPU keeps a window of trace entries and several
+   accesses in flight through the cache's Mem_if. Trace entries carry no
+   registers, so a load issues as soon as a lane is free unless an older
+   fence or atomic has not retired, and takes the data of an older store
+   to its address that is still in the window. Stores and atomics go to
+   the cache once they are the oldest entry. Entries retire in order. */
+struct CPU : public ProfiledModule
 {
 
 public:
     sc_in<bool>                 Port_CLK;
     sc_in<Cache::RetCode>      Port_MemDone;
     sc_out<Cache::Function>    Port_MemFunc;
-    sc_out<int>                 Port_MemAddr;
+    sc_out<addr_t>              Port_MemAddr;
     sc_inout_rv<8>              Port_MemData;
+    sc_port<Mem_if>             Port_Cache;
 
     int cpu_id;
 
+    /* Counters. */
+    long instructions;      // trace entries, NOPs included
+    long forwards;          // loads served from the store buffer
+    long sb_full_stalls;    // cycles a store waited for a free entry
+    long fence_stalls;      // cycles spent draining for fences and atomics
+    long window_stalls;     // cycles dispatch found the window full
+    long order_stalls;      // cycles loads waited for an older fence or atomic
+    long lane_cycles;       // accesses in flight, summed over cycles
+    long mem_cycles;        // cycles with at least one access in flight
+    sc_time finished;       // when the last entry retired
+
     SC_CTOR(CPU)
     {
         cpu_id = 0;
+        cpus_running++;
         SC_THREAD(execute);
         sensitive << Port_CLK.pos();
         dont_initialize();
+
+        SC_METHOD(mem_done);
+        sensitive << Port_MemDone;
+        dont_initialize();
+
+        instructions = 0;
+        forwards = 0;
+        sb_full_stalls = 0;
+        fence_stalls = 0;
+        window_stalls = 0;
+        order_stalls = 0;
+        lane_cycles = 0;
+        mem_cycles = 0;
+
+        sb_entries = 0;
+        window = 0;
+        lanes = 0;
+        idle_lanes = 0;
+        busy = false;
+        completed = false;
+        store_inflight = false;
+        hold_data = false;
     }
 
-private:
-    void execute()
+    /* Buffer up to n stores, must be called before the simulation starts. */
+    void store_buffer(int n)
     {
-        TraceFile::Entry    tr_data;
-        Cache::Function    f;
+        sb_entries = n;
+    }
 
-        // Loop until end of tracefile
-        while(!tracefile_ptr->eof())
+    void watch(StatsExport &stats, const string &prefix)
+    {
+        stats.counter(prefix + ".instructions", &instructions);
+        stats.counter(prefix + ".forwards", &forwards);
+        stats.counter(prefix + ".sb_full_stalls", &sb_full_stalls);
+        stats.counter(prefix + ".fence_stalls", &fence_stalls);
+        if (window > 0)
         {
-            // Get the next action for the processor in the trace
-            if(!tracefile_ptr->next(cpu_id, tr_data))
-            {
-                cerr << "Error reading trace for CPU: " <<  cpu_id  << endl;
-                break;
-            }
-
-            switch(tr_data.type)
-            {
-                case TraceFile::ENTRY_TYPE_READ:
-                    f = Cache::FUNC_READ;
-                    break;
+            stats.counter(prefix + ".window_stalls", &window_stalls);
+            stats.counter(prefix + ".order_stalls", &order_stalls);
+            stats.counter(prefix + ".lane_cycles", &lane_cycles);
+            stats.counter(prefix + ".mem_cycles", &mem_cycles);
+        }
+    }
 
-                case TraceFile::ENTRY_TYPE_WRITE:
-                    f = Cache::FUNC_WRITE;
-                    break;
+    /* Execute out of order with a window of entries and up to n accesses
+       in flight, must be called before the simulation starts. */
+    void out_of_order(int entries, int n)
+    {
+        window = entries;
+        lanes = n;
+        idle_lanes = n;
+    }
 
-                case TraceFile::ENTRY_TYPE_NOP:
-                    break;
+    /* Start the lanes once the clock port is bound. */
+    virtual void end_of_elaboration()
+    {
+        sc_spawn_options opts;
+        opts.set_sensitivity(&Port_CLK.posedge_event());
 
-                default:
-                    cerr << "Error, got invalid data from Trace" << endl;
-                    exit(0);
-            }
+        for (int i = 0; i < lanes; i++)
+        {
+            char name[16];
+            sprintf(name, "lane_%d", i);
+            sc_spawn(sc_bind(&CPU::lane, this), name, &opts);
+        }
+    }
 
-            if(tr_data.type != TraceFile::ENTRY_TYPE_NOP)
-            {
-                Port_MemAddr.write(tr_data.addr);
-                Port_MemFunc.write(f);
+private:
+    /* A retired store waiting for the cache. */
+    typedef struct {
+        addr_t addr;
+        uint8_t data;
+    } store_t;
+
+    std::deque<store_t> sb;
+    int sb_entries;
+
+    /* State of the cache port. */
+    bool busy;              // a request is outstanding
+    bool completed;         // ... and the cache has answered it
+    bool store_inflight;    // ... and it is the head of the store buffer
+    bool hold_data;         // write data is still driven
+    Cache::RetCode ret;
+    sc_event done_event;
+
+    /* An entry of the out-of-order window. */
+    typedef struct {
+        Cache::Function f;
+        addr_t addr;
+        uint8_t data;
+        bool mem;           // NOPs and fences need no access
+        bool fence;
+        bool issued;
+        bool done;
+    } slot_t;
+
+    std::deque<slot_t> rob;
+    int window;
+    int lanes;
+    int idle_lanes;
+    std::deque<slot_t *> issue_queue;
+    sc_event issue_event;
+
+    /* Get the next entry for this CPU from the active trace source. */
+    TraceStatus fetch(trace_entry_t &entry)
+    {
+        ProfileScope scope(PROF_TRACE);
 
-                if (f == Cache::FUNC_WRITE)
-                {
-                    cout << sc_time_stamp() << ": CPU: " <<  cpu_id << " sends write" << endl;
+        if (streamtrace_ptr != NULL)
+        {
+            TraceStatus status = streamtrace_ptr->next(cpu_id, entry);
+            if (status == TRACE_ENTRY) trace_entries++;
+            return status;
+        }
 
-                    uint8_t data = rand() % 255;
-                    Port_MemData.write(data);
-                    wait();
-                    Port_MemData.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
-                }
-                else
-                {
-                    cout << sc_time_stamp() << ": CPU: " <<  cpu_id << " sends read" << endl;
-                }
+        TraceFile::Entry tr_data;
 
-                wait(Port_MemDone.value_changed_event());
+        if (tracefile_ptr->eof()) return TRACE_END;
 
-                if (f == Cache::FUNC_READ)
-                {
-                    cout << sc_time_stamp() << ": CPU: " <<  cpu_id << " reads: " << Port_MemData.read() << endl;
-                }
-            }
-            else
-            {
-               // cout << sc_time_stamp() << ": CPU executes NOP" << endl;
-            }
-            // Advance one cycle in simulated time
-            wait();
+        if(!tracefile_ptr->next(cpu_id, tr_data))
+        {
+            cerr << "Error reading trace for CPU: " <<  cpu_id  << endl;
+            return TRACE_END;
         }
 
-        // Finished the Tracefile, now stop the simulation
-        sc_stop();
-    }
-};
-
-/* Bus class, provides a way to share one memory in multiple CPU + Caches. */
-class Bus : public Bus_if, public sc_module {
-public:
+        switch(tr_data.type)
+        {
+            case TraceFile::ENTRY_TYPE_READ:
+                entry.type = trace_entry_t::READ;
+                break;
 
-    /* Ports andkkk  vb Signals. */
-    sc_in<bool> Port_CLK;
-    sc_out<int> Port_BusReq;
-    sc_out<int> Port_BusWriter;
-  //  sc_signal_rv<32*8>  Port_BusData;
-    sc_signal_rv<32> Port_BusAddr;
+            case TraceFile::ENTRY_TYPE_WRITE:
+                entry.type = trace_entry_t::WRITE;
+                break;
 
+            case TraceFile::ENTRY_TYPE_NOP:
+                entry.type = trace_entry_t::NOP;
+                break;
 
-    /* Bus mutex. */
-    sc_mutex bus;
+            default:
+                cerr << "Error, got invalid data from Trace" << endl;
+                exit(0);
+        }
+        entry.addr = tr_data.addr;
+        trace_entries++;
 
-    /* Variables. */
-    long waits;
-    long reads;
-    long writes;
+        return TRACE_ENTRY;
+    }
 
-public:
-    /* Constructor. */
-    SC_CTOR(Bus) {
-        /* Handle Port_CLK to simulate delay */
-        sensitive << Port_CLK.pos();
+    static bool is_write(Cache::Function f)
+    {
+        return f == Cache::FUNC_WRITE || f == Cache::FUNC_RMW || f == Cache::FUNC_SC;
+    }
 
-        // Initialize some bus properties
-        Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+    /* Cache function for a trace entry, reads for NOPs and fences. */
+    static Cache::Function function(trace_entry_t::Type type)
+    {
+        switch (type)
+        {
+            case trace_entry_t::WRITE: return Cache::FUNC_WRITE;
+            case trace_entry_t::RMW:   return Cache::FUNC_RMW;
+            case trace_entry_t::LL:    return Cache::FUNC_LL;
+            case trace_entry_t::SC:    return Cache::FUNC_SC;
+            default:                   return Cache::FUNC_READ;
+        }
+    }
 
-        /* Update variables. */
-        waits = 0;
-        reads = 0;
-        writes = 0;
+    /* The cache answered the outstanding request. */
+    void mem_done()
+    {
+        completed = true;
+        ret = Port_MemDone.read();
+        done_event.notify();
     }
 
-    /* Perform a read access to memory addr for CPU #writer. */
-    virtual bool Rd(int writer, int addr){
-        /* Try to get exclusive lock on bus. */
-        while(bus.trylock() == -1){
-            /* Wait when bus is in contention. */
-            waits++;
-            wait();
+    /* Send a request to the cache, the port must be free. */
+    void issue(Cache::Function f, addr_t addr, uint8_t data)
+    {
+        Port_MemAddr.write(addr);
+        Port_MemFunc.write(f);
+        busy = true;
+        completed = false;
+
+        if (is_write(f))
+        {
+            Port_MemData.write(data);
+            hold_data = true;
         }
+    }
 
-        /* Update number of bus accesses. */
-        reads++;
+    void release_data()
+    {
+        Port_MemData.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+        hold_data = false;
+    }
 
-        /* Set lines. */
-        Port_BusAddr.write(addr);
-        Port_BusWriter.write(writer);
-        Port_BusReq.write(Cache::BUS_READ);
+    /* The outstanding request is done; a drained store leaves the buffer. */
+    void retire()
+    {
+        busy = false;
+        if (store_inflight)
+        {
+            sb.pop_front();
+            store_inflight = false;
+        }
+    }
 
-        /* Wait for everyone to recieve. */
+    /* Wait for the outstanding request to finish. */
+    Cache::RetCode wait_done()
+    {
+        // The cache reads the write data in the cycle it gets the request
+        if (hold_data)
+        {
+            wait();
+            release_data();
+        }
+        while (!completed) wait(done_event);
+        retire();
+        return ret;
+    }
+
+    /* Advance one cycle, draining the store buffer in the background. */
+    void cycle()
+    {
         wait();
+        if (hold_data) release_data();
+        if (busy && completed) retire();
 
-        Port_BusReq.write(Cache::BUS_FREE);
-        Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
-        bus.unlock();
+        if (!busy && !sb.empty())
+        {
+            store_inflight = true;
+            issue(Cache::FUNC_WRITE, sb.front().addr, sb.front().data);
+        }
+    }
 
-        return(true);
-    };
+    /* Blocking access, waits for a buffered store holding the port first. */
+    Cache::RetCode access(Cache::Function f, addr_t addr, uint8_t data)
+    {
+        while (busy) wait_done();
+        issue(f, addr, data);
+        return wait_done();
+    }
 
-    /* Write action to memory, need to know the writer, address and data. */
-    virtual bool Upgr(int writer, int addr, int data){
-        /* Try to get exclusive lock on the bus. */
-        while(bus.trylock() == -1){
-            waits++;
-            wait();
+    /* Wait until every buffered store has reached the cache. */
+    void drain(long &stalls)
+    {
+        while (busy || !sb.empty())
+        {
+            stalls++;
+            cycle();
         }
+    }
 
-        /* Update number of accesses. */
-        writes++;
+    void execute()
+    {
+        ProfileScope       scope(PROF_CPU);
+        trace_entry_t      tr_data;
+        Cache::Function    f;
+        TraceStatus        status;
 
-        /* Set. */
-        Port_BusAddr.write(addr);
-        Port_BusWriter.write(writer);
-        Port_BusReq.write(Cache::BUS_UPGR);
+        if (window > 0)
+        {
+            run_window();
+            finish();
+            return;
+        }
 
-        /* Wait for everyone to recieve. */
-        wait();
+        // Loop until end of tracefile
+        while((status = fetch(tr_data)) != TRACE_END)
+        {
+            // The stream has nothing for this CPU yet, try again next cycle
+            if (status == TRACE_STALL)
+            {
+                cycle();
+                continue;
+            }
 
-        /* Reset. */
-      	Port_BusReq.write(Cache::BUS_FREE);
-        Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
-        bus.unlock();
+            instructions++;
+            f = function(tr_data.type);
 
-        return(true);
+            if (tr_data.type == trace_entry_t::NOP)
+            {
+               // LOG_TRACE(sc_time_stamp() << ": CPU executes NOP");
+            }
+            else if (tr_data.type == trace_entry_t::FENCE)
+            {
+                drain(fence_stalls);
+            }
+            else if (sb_entries > 0 && f == Cache::FUNC_WRITE)
+            {
+                while ((int)sb.size() >= sb_entries)
+                {
+                    sb_full_stalls++;
+                    cycle();
+                }
+
+                store_t store;
+                store.addr = tr_data.addr;
+                store.data = rand() % 255;
+                sb.push_back(store);
+                LOG_TRACE(sc_time_stamp() << ": CPU: " <<  cpu_id << " buffers write");
+            }
+            else if (sb_entries > 0 && f == Cache::FUNC_READ && forward(tr_data.addr))
+            {
+                forwards++;
+            }
+            else
+            {
+                // Atomics are ordered after all earlier stores
+                if (f != Cache::FUNC_READ) drain(fence_stalls);
+
+                if (is_write(f))
+                {
+                    LOG_TRACE(sc_time_stamp() << ": CPU: " <<  cpu_id << " sends " << (f == Cache::FUNC_WRITE ? "write" : f == Cache::FUNC_RMW ? "atomic" : "store-conditional"));
+                }
+                else
+                {
+                    LOG_TRACE(sc_time_stamp() << ": CPU: " <<  cpu_id << " sends " << (f == Cache::FUNC_LL ? "load-linked" : "read"));
+                }
+
+                if (access(f, tr_data.addr, rand() % 255) == Cache::RET_SC_FAILED)
+                {
+                    LOG_TRACE(sc_time_stamp() << ": CPU: " <<  cpu_id << " store-conditional failed");
+                }
+                else if (!is_write(f))
+                {
+                    LOG_TRACE(sc_time_stamp() << ": CPU: " <<  cpu_id << " reads: " << Port_MemData.read());
+                }
+            }
+
+            // Advance one cycle in simulated time
+            cycle();
+        }
+
+        // Stores still in the buffer have to reach the cache
+        long stalls = 0;
+        drain(stalls);
+        finish();
     }
 
-    virtual bool RdX(int writer, int addr){
-        /* Try to get exclusive lock on the bus. */
-        while(bus.trylock() == -1){
-            waits++;
+    /* This CPU is through its trace. */
+    void finish()
+    {
+        finished = sc_time_stamp();
+
+        // A stream ends per CPU; only stop once the last CPU has finished
+        if (streamtrace_ptr != NULL && --cpus_running > 0) return;
+
+        // Finished the Tracefile, now stop the simulation
+        sc_stop();
+    }
+
+    /* Out-of-order execution: every cycle retire, dispatch and issue. */
+    void run_window()
+    {
+        bool end = false;
+
+        while (!end || !rob.empty())
+        {
+            // Retire in order, an access only once the cache is done
+            for (int n = 0; n < ooo_width && !rob.empty(); n++)
+            {
+                if (rob.front().mem && !rob.front().done) break;
+                rob.pop_front();
+                instructions++;
+            }
+
+            // Dispatch new entries into the window
+            for (int n = 0; !end && n < ooo_width; n++)
+            {
+                if ((int)rob.size() >= window)
+                {
+                    window_stalls++;
+                    break;
+                }
+
+                trace_entry_t tr_data;
+                TraceStatus status = fetch(tr_data);
+                if (status == TRACE_END) end = true;
+                if (status != TRACE_ENTRY) break;
+
+                slot_t s;
+                s.f = function(tr_data.type);
+                s.addr = tr_data.addr;
+                s.data = rand() % 255;
+                s.fence = tr_data.type == trace_entry_t::FENCE;
+                s.mem = tr_data.type != trace_entry_t::NOP && !s.fence;
+                s.issued = false;
+                s.done = false;
+                rob.push_back(s);
+            }
+
+            // Issue oldest first
+            bool barrier = false;   // an older fence or atomic has not retired
+            for (size_t i = 0; i < rob.size(); i++)
+            {
+                slot_t &s = rob[i];
+                bool load = s.f == Cache::FUNC_READ;
+
+                if (s.mem && !s.issued)
+                {
+                    if (!load)
+                    {
+                        if (i == 0) start(s);
+                    }
+                    else if (barrier)
+                    {
+                        order_stalls++;
+                    }
+                    else
+                    {
+                        // disambiguation: the address of every older store is known
+                        int j = older_store(i);
+                        if (j < 0) start(s);
+                        else
+                        {
+                            LOG_TRACE(sc_time_stamp() << ": CPU: " <<  cpu_id << " reads: " << (int)rob[j].data << " (forwarded)");
+                            s.issued = true;
+                            s.done = true;
+                            forwards++;
+                        }
+                    }
+                }
+
+                if (s.fence || (s.mem && !load && s.f != Cache::FUNC_WRITE)) barrier = true;
+            }
+
+            if (idle_lanes < lanes)
+            {
+                mem_cycles++;
+                lane_cycles += lanes - idle_lanes;
+            }
+
             wait();
         }
+    }
+
+    /* Youngest entry older than i that writes its address and is not done,
+       -1 if there is none. */
+    int older_store(size_t i)
+    {
+        for (int j = (int)i - 1; j >= 0; j--)
+        {
+            if (rob[j].mem && rob[j].addr == rob[i].addr && is_write(rob[j].f) && !rob[j].done) return j;
+        }
+        return -1;
+    }
 
-        /* Update number of accesses. */
+    /* Hand an entry to a free lane, if there is one. */
+    void start(slot_t &s)
+    {
+        if (idle_lanes == 0) return;
+
+        idle_lanes--;
+        s.issued = true;
+        issue_queue.push_back(&s);
+        issue_event.notify();
+    }
+
+    /* Carries the window's accesses to the cache, one at a time. */
+    void lane()
+    {
+        ProfileScope scope(PROF_CPU);
+
+        while (true)
+        {
+            while (issue_queue.empty()) wait(issue_event);
+
+            slot_t *s = issue_queue.front();
+            issue_queue.pop_front();
+
+            if (Port_Cache->access(s->f, s->addr, s->data) == Cache::RET_SC_FAILED)
+            {
+                LOG_TRACE(sc_time_stamp() << ": CPU: " <<  cpu_id << " store-conditional failed");
+            }
+            else if (!is_write(s->f))
+            {
+                LOG_TRACE(sc_time_stamp() << ": CPU: " <<  cpu_id << " reads: " << (int)s->data);
+            }
+
+            s->done = true;
+            idle_lanes++;
+        }
+    }
+
+    /* Store-to-load forwarding from the youngest buffered store. */
+    bool forward(addr_t addr)
+    {
+        for (std::deque<store_t>::reverse_iterator i = sb.rbegin(); i != sb.rend(); ++i)
+        {
+            if (i->addr == addr)
+            {
+                LOG_TRACE(sc_time_stamp() << ": CPU: " <<  cpu_id << " reads: " << (int)i->data << " (forwarded)");
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/* Bus class, provides a way to share one memory in multiple CPU + Caches.
+   By default the bus is only held for the address cycle of a request, the
+   requester then waits for memory on its own. In split-transaction mode
+   every Rd/RdX gets a tag, at most max_inflight tagged requests are
+   outstanding, and the data returns in a separate response phase that
+   competes for the data bus. Data travels with the address in one cycle
+   unless the data timing is modeled: then a data phase takes one cycle
+   per beat of width bytes plus a turnaround after every burst, and a
+   non-split Rd/RdX wins the bus again for its data phase. */
+class Bus : public Interconnect, public ProfiledModule {
+public:
+
+    /* Ports andkkk  vb Signals. */
+    sc_in<bool> Port_CLK;
+    sc_signal<int> Port_BusReq;
+    sc_signal<int> Port_BusWriter;
+  //  sc_signal_rv<32*8>  Port_BusData;
+    sc_signal_rv<ADDR_BITS> Port_BusAddr;
+
+    /* Snooping caches, in cache_id order. */
+    sc_port<Snoop_if, 0> Port_Snoop;
+
+
+    /* Bus mutex. */
+    sc_mutex bus;
+
+    /* Data bus mutex, only used in split-transaction mode. */
+    sc_mutex data_bus;
+
+    /* Variables. */
+    long waits;
+    long reads;
+    long writes;
+    long memory_reads;      // line fills from memory
+    long transfers;         // line fills supplied by another cache
+    long writebacks;
+    long updates;           // writes that updated the other copies
+
+    /* Split-transaction state and counters. */
+    bool split_transactions;
+    int  max_inflight;
+    int  inflight;
+    long inflight_peak;
+    long tag_waits;
+    long data_waits;
+    long responses;
+
+    /* Snoop filter, NULL when every request is presented to all caches. */
+    SnoopFilter *filter;
+
+    /* Data timing and occupancy. */
+    bool timed;             // data phases take data_cycles()
+    int  width;
+    int  burst;
+    int  turnaround;
+    long busy;              // cycles the (address) bus was held
+    long data_busy;         // cycles the data bus was held, split mode only
+
+    /* Busy cycles per window of util_window cycles, 0 when not sampled. */
+    int  util_window;
+    std::vector<long> util;
+
+private:
+    /* An outstanding tagged transaction. */
+    typedef struct {
+        bool busy;
+        sc_time issued;
+    } transaction_t;
+
+    std::vector<transaction_t> outstanding;
+
+    /* Summed issue-to-response time of completed split transactions. */
+    sc_time total_latency;
+
+public:
+    /* Constructor. */
+    SC_CTOR(Bus) {
+        /* Handle Port_CLK to simulate delay */
+        sensitive << Port_CLK.pos();
+
+        // Initialize some bus properties
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(SC_LOGIC_Z));
+
+        /* Update variables. */
+        waits = 0;
+        reads = 0;
+        writes = 0;
+        memory_reads = 0;
+        transfers = 0;
+        writebacks = 0;
+        updates = 0;
+
+        split_transactions = false;
+        max_inflight = 0;
+        inflight = 0;
+        inflight_peak = 0;
+        tag_waits = 0;
+        data_waits = 0;
+        responses = 0;
+
+        filter = NULL;
+
+        timed = false;
+        width = BUS_WIDTH;
+        burst = BUS_BURST;
+        turnaround = BUS_TURNAROUND;
+        busy = 0;
+        data_busy = 0;
+        util_window = 0;
+    }
+
+    ~Bus() {
+        delete filter;
+    }
+
+    /* Model the data phase timing, must be called before the simulation
+       starts. */
+    void timing(int w, int b, int t) {
+        timed = true;
+        width = w;
+        burst = b;
+        turnaround = t;
+    }
+
+    /* Cycles to move bytes over the data lines. */
+    int data_cycles(int bytes) const {
+        int beats = (bytes + width - 1) / width;
+        int bursts = (beats + burst - 1) / burst;
+        return beats + bursts * turnaround;
+    }
+
+    /* Switch to split-transaction mode with at most n outstanding requests.
+       Must be called before the simulation starts. */
+    void split(int n) {
+        split_transactions = true;
+        max_inflight = n;
+        outstanding.assign(n, transaction_t());
+    }
+
+    /* Only snoop the caches that may hold a line, tracked for up to
+       entries lines. Must be called before the simulation starts. */
+    void snoop_filter(int entries) {
+        filter = new SnoopFilter(num_cpus, entries);
+    }
+
+    virtual void attach(Snoop_if &cache) {
+        Port_Snoop(cache);
+    }
+
+    /* Perform a read access to memory addr for CPU #writer. */
+    virtual bool Rd(int writer, addr_t addr, line_data_t &line){
+        ProfileScope scope(PROF_BUS);
+
+        /* Update number of bus accesses. */
         reads++;
 
-        /* Set lines. */
-        Port_BusAddr.write(addr);
-        Port_BusWriter.write(writer);
-        Port_BusReq.write(Cache::BUS_READX);
+        return fetch(writer, addr, Cache::BUS_READ, line);
+    };
 
-        /* Wait for everyone to recieve. */
-        wait();
+    /* Write action to memory, need to know the writer, address and data. */
+    virtual bool Upgr(int writer, addr_t addr, int /* data */){
+        ProfileScope scope(PROF_BUS);
 
-        Port_BusReq.write(Cache::BUS_FREE);
-        Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
-        bus.unlock();
+        /* Update number of accesses. */
+        writes++;
+
+        /* Address only, no data phase in either mode. */
+        request(writer, addr, Cache::BUS_UPGR, NULL, 0);
 
         return(true);
     }
 
-    virtual bool flush(int writer, int addr, uint8_t data[32]){
+    virtual bool RdX(int writer, addr_t addr, line_data_t &line){
+        ProfileScope scope(PROF_BUS);
+
+        /* Update number of accesses. */
+        reads++;
+
+        fetch(writer, addr, Cache::BUS_READX, line);
+
+        return(false);
+    }
+
+    /* Broadcast a written word, address and data in one bus cycle. */
+    virtual bool Upd(int writer, addr_t addr, int data){
+        ProfileScope scope(PROF_BUS);
+
+        line_data_t word;
+
+        /* Update number of accesses. */
+        writes++;
+        updates++;
+
+        word.supplied = false;
+        word.data[addr & (line_size - 1)] = (uint8_t)data;
+        return request(writer, addr, Cache::BUS_UPD, &word, 1);
+    }
+
+    virtual bool flush(int writer, addr_t addr, uint8_t /* data */[MAX_LINE_SIZE]){
+        ProfileScope scope(PROF_BUS);
+
         /* Try to get exclusive lock on the bus. */
         while(bus.trylock() == -1){
             waits++;
@@ -778,33 +1656,382 @@ public:
         }
 
         /* Update number of accesses. */
-        reads++;
+        writebacks++;
 
         /* Set lines. */
-        Port_BusAddr.write(addr);
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(addr));
         Port_BusWriter.write(writer);
       //  Port_BusData.write(data);
         Port_BusReq.write(Cache::FLUSH);
 
-        /* Wait for everyone to recieve. */
-        wait();
+        /* Address and the whole line. */
+        hold(timed ? 1 + data_cycles(line_size) : 1, busy);
 
-        Port_BusReq.write(Cache::FLUSH);
-        Port_BusAddr.write("ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ");
+        Port_BusReq.write(Cache::BUS_FREE);
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(SC_LOGIC_Z));
         bus.unlock();
 
+        memory_access(addr, true);
+
         return(true);
     }
 
     /* Bus output. */
-    void output(){
+    virtual void output(const sc_time &cycle){
         /* Write output as specified in the assignment. */
         double avg = (double)waits / double(reads + writes);
         printf("\n 2. Main memory access rates\n");
         printf("    Bus had %ld reads and %ld writes.\n", reads, writes);
         printf("    A total of %ld accesses.\n", reads + writes);
+        printf("    %ld lines came from memory, %ld from another cache; %ld write-backs.\n", memory_reads, transfers, writebacks);
+        printf("    %ld of the writes updated other copies.\n", updates);
         printf("\n 3. Average time for bus acquisition\n");
         printf("    There were %ld waits for the bus.\n", waits);
         printf("    Average waiting time per access: %f cycles.\n", avg);
+        if (timed) {
+            printf("    Bus is %d bytes wide with bursts of %d beats and %d turnaround cycles, %d cycles per line.\n",
+                   width, burst, turnaround, data_cycles(line_size));
+        }
+        printf("    Bus was busy %f%% of the time", 100.0 * busy / (sc_time_stamp() / cycle));
+        if (split_transactions) printf(", data bus %f%%", 100.0 * data_busy / (sc_time_stamp() / cycle));
+        printf(".\n");
+        if (util_window > 0) {
+            printf("    Utilization per %d cycles (%%):", util_window);
+            for (size_t i = 0; i < util.size(); i++) {
+                if (i % 10 == 0) printf("\n   ");
+                printf(" %5.1f", 100.0 * util[i] / util_window);
+            }
+            printf("\n");
+        }
+
+        if (split_transactions) {
+            printf("\n 4. Split-transaction bus\n");
+            printf("    Up to %d transactions in flight, peak was %ld.\n", max_inflight, inflight_peak);
+            printf("    There were %ld waits for a free tag and %ld waits for the data bus.\n", tag_waits, data_waits);
+            printf("    Average transaction latency: %f cycles.\n",
+                   responses ? total_latency / cycle / responses : 0.0);
+            printf("    Bandwidth: %f transactions per cycle.\n", (reads + writes) / (sc_time_stamp() / cycle));
+        }
+
+        if (filter != NULL) {
+            printf("\n 5. Snoop filter\n");
+            printf("    %ld probes sent, %ld filtered (%f%%).\n", filter->probes, filter->filtered,
+                   filter->probes + filter->filtered ? 100.0 * filter->filtered / (filter->probes + filter->filtered) : 0.0);
+            printf("    %ld entries evicted, %ld back-invalidations.\n", filter->evictions, filter->back_invalidations);
+        }
+    }
+
+    virtual void watch(StatsExport &stats) {
+        watch(stats, "bus");
+    }
+
+    void watch(StatsExport &stats, const string &prefix) {
+        stats.counter(prefix + ".reads", &reads);
+        stats.counter(prefix + ".writes", &writes);
+        stats.counter(prefix + ".waits", &waits);
+        stats.counter(prefix + ".memory_reads", &memory_reads);
+        stats.counter(prefix + ".transfers", &transfers);
+        stats.counter(prefix + ".writebacks", &writebacks);
+        stats.counter(prefix + ".updates", &updates);
+        stats.counter(prefix + ".busy", &busy);
+        if (split_transactions) stats.counter(prefix + ".data_busy", &data_busy);
+        if (filter != NULL) {
+            stats.counter(prefix + ".filter.probes", &filter->probes);
+            stats.counter(prefix + ".filter.filtered", &filter->filtered);
+            stats.counter(prefix + ".filter.back_invalidations", &filter->back_invalidations);
+        }
+    }
+
+private:
+    /* Drive an address-phase request onto the bus for one cycle, during
+       which all caches snoop it, followed by payload bytes of data.
+       Returns true when a cache kept a copy. */
+    bool request(int writer, addr_t addr, int req, line_data_t *line, int payload) {
+        /* Try to get exclusive lock on the bus. */
+        while(bus.trylock() == -1){
+            /* Wait when bus is in contention. */
+            waits++;
+            wait();
+        }
+
+        /* A snoop may have taken the line of an upgrade or update while it
+           waited, the requester reissues it as a miss. */
+        if ((req == Cache::BUS_UPGR || req == Cache::BUS_UPD) && !Port_Snoop[writer]->holds(addr)) {
+            bus.unlock();
+            return false;
+        }
+
+        /* Set lines. */
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(addr));
+        Port_BusWriter.write(writer);
+        Port_BusReq.write(req);
+
+        bool copies = false;
+        if (filter != NULL) {
+            copies = filtered_snoop(writer, addr, req, line);
+        }
+        else {
+            for (int i = 0; i < Port_Snoop.size(); i++) {
+                if (Port_Snoop[i]->snoop(writer, addr, req, line)) copies = true;
+            }
+        }
+
+        /* Wait for everyone to recieve. */
+        hold(timed && payload ? 1 + data_cycles(payload) : 1, busy);
+
+        /* Reset. */
+        Port_BusReq.write(Cache::BUS_FREE);
+        Port_BusAddr.write(sc_lv<ADDR_BITS>(SC_LOGIC_Z));
+        bus.unlock();
+
+        return copies;
+    }
+
+    /* Bring a line in for a Rd or RdX, from the cache that supplies it or
+       else from memory. Returns true when another cache kept a copy. */
+    bool fetch(int writer, addr_t addr, int req, line_data_t &line) {
+        bool copies;
+
+        line.supplied = false;
+
+        if (!split_transactions) {
+            copies = request(writer, addr, req, &line, 0);
+            fill_line(addr, line);
+            if (!timed) return copies;
+
+            /* Data phase, the line returns over the same bus. */
+            while(bus.trylock() == -1){
+                waits++;
+                wait();
+            }
+            hold(data_cycles(line_size), busy);
+            bus.unlock();
+            return copies;
+        }
+
+        /* A request may only be issued with a free tag. */
+        int tag;
+        while ((tag = alloc_tag()) < 0) {
+            tag_waits++;
+            wait();
+        }
+        outstanding[tag].issued = sc_time_stamp();
+
+        /* Request phase, the address bus is free again afterwards. */
+        copies = request(writer, addr, req, &line, 0);
+
+        fill_line(addr, line);
+
+        /* Response phase, the data returns over the data bus. */
+        while(data_bus.trylock() == -1){
+            data_waits++;
+            wait();
+        }
+        hold(timed ? data_cycles(line_size) : 1, data_busy);
+        data_bus.unlock();
+
+        total_latency += sc_time_stamp() - outstanding[tag].issued;
+        responses++;
+        outstanding[tag].busy = false;
+        inflight--;
+
+        return copies;
+    }
+
+    /* Snoop only the caches the filter lists for the line and record the
+       requester as a holder. Returns true when a cache kept a copy. */
+    bool filtered_snoop(int writer, addr_t addr, int req, line_data_t *line) {
+        SnoopFilter::entry_t *e = filter->find(addr / line_size);
+        SnoopFilter::entry_t victim;
+        bool copies = false;
+        int probed = 0;
+
+        if (e != NULL) {
+            for (int i = SnoopFilter::next(*e, 0); i >= 0; i = SnoopFilter::next(*e, i + 1)) {
+                if (i == writer) continue;
+                probed++;
+                // Caches that gave up the line are no longer holders
+                if (Port_Snoop[i]->snoop(writer, addr, req, line)) copies = true;
+                else SnoopFilter::clear(*e, i);
+            }
+        }
+        filter->probes += probed;
+        filter->filtered += Port_Snoop.size() - 1 - probed;
+
+        e = filter->insert(addr / line_size, victim);
+        SnoopFilter::set(*e, writer);
+
+        /* Keep the filter inclusive. A dirty copy is written back while
+           we still hold the bus. */
+        if (victim.valid) {
+            for (int i = SnoopFilter::next(victim, 0); i >= 0; i = SnoopFilter::next(victim, i + 1)) {
+                line_data_t dirty;
+                dirty.supplied = false;
+                filter->back_invalidations++;
+                Port_Snoop[i]->snoop(-1, victim.line * line_size, Cache::BUS_INVAL, &dirty);
+                if (dirty.supplied) {
+                    writebacks++;
+                    if (timed) hold(data_cycles(line_size), busy);
+                    memory_access(victim.line * line_size, true);
+                }
+            }
+        }
+
+        return copies;
+    }
+
+    /* Wait for a line from the cache that supplies it or from memory. */
+    void fill_line(addr_t addr, const line_data_t &line) {
+        if (line.supplied) {
+            transfers++;
+            wait(c2c_latency);
+            return;
+        }
+        memory_reads++;
+        memory_access(addr, false);
+    }
+
+    /* Keep the bus held for cycles and account for them in counter. */
+    void hold(int cycles, long &counter) {
+        for (int i = 0; i < cycles; i++) {
+            wait();
+            counter++;
+        }
+    }
+
+    int alloc_tag() {
+        for (int i = 0; i < max_inflight; i++) {
+            if (!outstanding[i].busy) {
+                outstanding[i].busy = true;
+                inflight++;
+                if (inflight > inflight_peak) inflight_peak = inflight;
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+/* Samples the registered counters every interval cycles for the time
+   series in the stats files. */
+SC_MODULE(StatsSampler)
+{
+public:
+    sc_in<bool> Port_CLK;
+
+    StatsExport *stats;
+    int interval;
+
+    SC_CTOR(StatsSampler)
+    {
+        stats = NULL;
+        interval = 0;
+        SC_THREAD(sample);
+        sensitive << Port_CLK.pos();
+        dont_initialize();
+    }
+
+private:
+    void sample()
+    {
+        long cycle = 0;
+
+        while (true)
+        {
+            wait(interval);
+            cycle += interval;
+            stats->sample(cycle);
+        }
+    }
+};
+
+/* Records the busy cycles of a bus every util_window cycles for its
+   utilization report. */
+SC_MODULE(BusSampler)
+{
+public:
+    sc_in<bool> Port_CLK;
+
+    Bus *bus;
+
+    SC_CTOR(BusSampler)
+    {
+        bus = NULL;
+        SC_THREAD(sample);
+        sensitive << Port_CLK.pos();
+        dont_initialize();
+    }
+
+private:
+    void sample()
+    {
+        long last = 0;
+
+        while (true)
+        {
+            wait(bus->util_window);
+            bus->util.push_back(bus->busy - last);
+            last = bus->busy;
+        }
+    }
+};
+
+/* Copies the counters into the live counter segment every interval cycles. */
+SC_MODULE(LivePublisher)
+{
+    sc_in<bool> Port_CLK;
+
+    LiveCounters *live;
+    int interval;
+
+    SC_CTOR(LivePublisher)
+    {
+        live = NULL;
+        interval = 0;
+        SC_THREAD(publish);
+        sensitive << Port_CLK.pos();
+        dont_initialize();
+    }
+
+private:
+    void publish()
+    {
+        long cycle = 0;
+
+        while (true)
+        {
+            wait(interval);
+            cycle += interval;
+            live->update(cycle);
+        }
+    }
+};
+
+/* Reports the host throughput every interval cycles during the run. */
+SC_MODULE(ProfileReporter)
+{
+    sc_in<bool> Port_CLK;
+
+    int interval;
+
+    SC_CTOR(ProfileReporter)
+    {
+        interval = 0;
+        SC_THREAD(report);
+        sensitive << Port_CLK.pos();
+        dont_initialize();
+    }
+
+private:
+    void report()
+    {
+        long cycle = 0;
+
+        while (true)
+        {
+            wait(interval);
+            cycle += interval;
+            HostProfiler::progress(cycle, trace_entries);
+        }
     }
 };
@@ -0,0 +1,357 @@
+/*
+// File: directory.h
+//
+// Directory-based coherence as an alternative to the snooping interconnects.
+// The home directory of a line knows which caches may hold it and only
+// sends invalidations and forwards to those caches, instead of presenting
+// every request to every cache. The sharers are kept either as a full bit
+// vector or as a limited number of pointers that falls back to broadcast
+// when they run out (Dir_i B).
+//
+// Caches evict clean lines silently, so a directory entry may list caches
+// that no longer hold the line. A forward to such a stale owner is
+// answered from memory instead. Dirty lines are written back through
+// flush, which removes the cache from the entry.
+*/
+
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <map>
+
+/* Default cycles for a directory lookup at the home bank. */
+#define DIR_LATENCY         2
+
+/* Default cycles to forward a request from the home to the owner, on top
+   of the owner supplying the line. */
+#define DIR_FORWARD_LATENCY 2
+
+/* Directory latencies, set by sc_main. */
+int dir_latency = DIR_LATENCY;
+int dir_forward_latency = DIR_FORWARD_LATENCY;
+
+class Directory : public Interconnect, public ProfiledModule
+{
+public:
+    sc_in<bool> Port_CLK;
+
+    /* Caches, in cache_id order, for targeted invalidations and forwards. */
+    sc_port<Snoop_if, 0> Port_Snoop;
+
+    /* Counters. */
+    long reads;
+    long writes;
+    long waits;
+    long invalidations;
+    long forwards;
+    long stale_forwards;
+    long broadcasts;
+    long memory_reads;
+    long transfers;
+    long writebacks;
+    long updates;
+
+    /* Directory for cpus caches with banks home banks. pointers == 0 keeps
+       a full bit vector per line, otherwise at most that many sharers are
+       tracked before falling back to broadcast. */
+    Directory(sc_module_name name, int cpus, int banks, int pointers)
+        : ProfiledModule(name), cpus(cpus), pointers(pointers), homes(banks)
+    {
+        for (int i = 0; i < banks; i++) homes[i] = new sc_mutex();
+
+        reads = 0;
+        writes = 0;
+        waits = 0;
+        invalidations = 0;
+        forwards = 0;
+        stale_forwards = 0;
+        broadcasts = 0;
+        memory_reads = 0;
+        transfers = 0;
+        writebacks = 0;
+        updates = 0;
+    }
+
+    virtual void attach(Snoop_if &cache) {
+        Port_Snoop(cache);
+    }
+
+    /* Read miss: forward to the owner if there is one, else read memory. */
+    virtual bool Rd(int writer, addr_t addr, line_data_t &line) {
+        ProfileScope scope(PROF_BUS);
+
+        reads++;
+
+        sc_mutex *home = lookup(addr);
+        dir_entry_t &e = entry(addr);
+        bool copies = false;
+
+        line.supplied = false;
+
+        // Missing on a line we own means we dropped it silently
+        if (e.owner == writer) e.owner = -1;
+
+        if (e.owner >= 0)
+        {
+            forwards++;
+            if (Port_Snoop[e.owner]->snoop(writer, addr, Cache::BUS_READ, &line))
+            {
+                copies = true;
+            }
+            else
+            {
+                // The owner evicted the line silently
+                stale_forwards++;
+                remove_sharer(e, e.owner);
+                e.owner = -1;
+            }
+        }
+        if (!copies) copies = has_other_sharers(e, writer);
+
+        add_sharer(e, writer);
+        // A sole copy is handed out exclusive and may be written silently
+        if (!copies) e.owner = writer;
+
+        home->unlock();
+
+        fill_line(addr, line);
+        return copies;
+    }
+
+    /* Write hit on a shared line: invalidate the other sharers. */
+    virtual bool Upgr(int writer, addr_t addr, int /* data */) {
+        ProfileScope scope(PROF_BUS);
+
+        writes++;
+
+        sc_mutex *home = lookup(addr);
+        // the writer lost its copy while it waited, it reissues the write
+        if (Port_Snoop[writer]->holds(addr)) invalidate(entry(addr), writer, addr, Cache::BUS_UPGR, NULL);
+        home->unlock();
+
+        return false;
+    }
+
+    /* Write miss: invalidate all other copies and read the line, a dirty
+       copy is supplied by its owner. */
+    virtual bool RdX(int writer, addr_t addr, line_data_t &line) {
+        ProfileScope scope(PROF_BUS);
+
+        reads++;
+
+        line.supplied = false;
+
+        sc_mutex *home = lookup(addr);
+        invalidate(entry(addr), writer, addr, Cache::BUS_READX, &line);
+        home->unlock();
+
+        fill_line(addr, line);
+        return false;
+    }
+
+    /* Write to a shared line in an update protocol: send the word to the
+       sharers only. The writer becomes the owner. */
+    virtual bool Upd(int writer, addr_t addr, int data) {
+        ProfileScope scope(PROF_BUS);
+
+        writes++;
+        updates++;
+
+        line_data_t word;
+        word.supplied = false;
+        word.data[addr & (line_size - 1)] = (uint8_t)data;
+
+        sc_mutex *home = lookup(addr);
+        if (!Port_Snoop[writer]->holds(addr)) {
+            // the writer lost its copy while it waited, it reissues the write
+            home->unlock();
+            return false;
+        }
+
+        dir_entry_t &e = entry(addr);
+        bool copies = false;
+        int sent = 0;
+
+        if (pointers && e.overflow) broadcasts++;
+
+        for (int i = 0; i < cpus; i++) {
+            if (i == writer || !is_sharer(e, i)) continue;
+            sent++;
+            if (Port_Snoop[i]->snoop(writer, addr, Cache::BUS_UPD, &word)) copies = true;
+            else if (!pointers || !e.overflow) remove_sharer(e, i);
+        }
+        e.owner = writer;
+
+        // The updates travel in parallel
+        if (sent) wait();
+        home->unlock();
+
+        return copies;
+    }
+
+    /* Write-back of an evicted dirty line, the writer no longer holds it. */
+    virtual bool flush(int writer, addr_t addr, uint8_t /* data */[MAX_LINE_SIZE]) {
+        ProfileScope scope(PROF_BUS);
+
+        writebacks++;
+
+        sc_mutex *home = lookup(addr);
+        dir_entry_t &e = entry(addr);
+        if (e.owner == writer) e.owner = -1;
+        remove_sharer(e, writer);
+        home->unlock();
+
+        memory_access(addr, true);
+        return true;
+    }
+
+    virtual void output(const sc_time &/* cycle */) {
+        printf("\n 2. Main memory access rates\n");
+        printf("    Directory had %ld reads and %ld writes.\n", reads, writes);
+        printf("    A total of %ld accesses.\n", reads + writes);
+        printf("    %ld lines came from memory, %ld from another cache; %ld write-backs.\n", memory_reads, transfers, writebacks);
+        printf("    %ld of the writes updated other copies.\n", updates);
+        printf("\n 3. Average time for directory acquisition\n");
+        printf("    There were %ld waits for a home directory.\n", waits);
+        printf("    Average waiting time per access: %f cycles.\n", (double)waits / double(reads + writes));
+        printf("\n 4. Directory (%s, %d home banks, %ld lines tracked)\n",
+               pointers ? "limited pointers" : "full bit vector", (int)homes.size(), (long)entries.size());
+        printf("    Sent %ld invalidations, %f per request.\n", invalidations,
+               reads + writes ? (double)invalidations / double(reads + writes) : 0.0);
+        printf("    Forwarded %ld reads to an owner, %ld of them stale.\n", forwards, stale_forwards);
+        if (pointers) printf("    %ld requests were broadcast after a pointer overflow.\n", broadcasts);
+    }
+
+    virtual void watch(StatsExport &stats) {
+        stats.counter("directory.reads", &reads);
+        stats.counter("directory.writes", &writes);
+        stats.counter("directory.waits", &waits);
+        stats.counter("directory.invalidations", &invalidations);
+        stats.counter("directory.forwards", &forwards);
+        stats.counter("directory.stale_forwards", &stale_forwards);
+        stats.counter("directory.broadcasts", &broadcasts);
+        stats.counter("directory.memory_reads", &memory_reads);
+        stats.counter("directory.transfers", &transfers);
+        stats.counter("directory.writebacks", &writebacks);
+        stats.counter("directory.updates", &updates);
+    }
+
+private:
+    /* Directory state of one line. */
+    typedef struct dir_entry {
+        dir_entry() : owner(-1), overflow(false) {}
+        int owner;                      // exclusive, modified or owned copy, -1 if none
+        std::vector<uint64_t> bits;     // full bit vector
+        std::vector<int> ptrs;          // limited pointers
+        bool overflow;                  // pointers ran out, sharers unknown
+    } dir_entry_t;
+
+    int cpus;
+    int pointers;
+    std::vector<sc_mutex *> homes;
+    std::map<addr_t, dir_entry_t> entries;
+
+    dir_entry_t &entry(addr_t addr) {
+        dir_entry_t &e = entries[addr / line_size];
+        if (!pointers && e.bits.empty()) e.bits.assign((cpus + 63) / 64, 0);
+        return e;
+    }
+
+    /* Acquire the home bank of addr and pay for the lookup. */
+    sc_mutex *lookup(addr_t addr) {
+        sc_mutex *home = homes[bank_of(addr, homes.size())];
+
+        while (home->trylock() == -1) {
+            waits++;
+            wait();
+        }
+        wait(dir_latency);
+
+        return home;
+    }
+
+    bool is_sharer(const dir_entry_t &e, int cache) const {
+        if (!pointers) return (e.bits[cache / 64] >> (cache % 64)) & 1;
+        if (e.overflow) return true;
+        for (size_t i = 0; i < e.ptrs.size(); i++) {
+            if (e.ptrs[i] == cache) return true;
+        }
+        return false;
+    }
+
+    bool has_other_sharers(const dir_entry_t &e, int cache) const {
+        for (int i = 0; i < cpus; i++) {
+            if (i != cache && is_sharer(e, i)) return true;
+        }
+        return false;
+    }
+
+    void add_sharer(dir_entry_t &e, int cache) {
+        if (!pointers) {
+            e.bits[cache / 64] |= (uint64_t)1 << (cache % 64);
+        }
+        else if (!e.overflow && !is_sharer(e, cache)) {
+            if ((int)e.ptrs.size() < pointers) {
+                e.ptrs.push_back(cache);
+            }
+            else {
+                e.overflow = true;
+                e.ptrs.clear();
+            }
+        }
+    }
+
+    void remove_sharer(dir_entry_t &e, int cache) {
+        if (!pointers) {
+            e.bits[cache / 64] &= ~((uint64_t)1 << (cache % 64));
+            return;
+        }
+        for (size_t i = 0; i < e.ptrs.size(); i++) {
+            if (e.ptrs[i] == cache) {
+                e.ptrs.erase(e.ptrs.begin() + i);
+                return;
+            }
+        }
+    }
+
+    /* Wait for a line from the owner that supplies it or from memory. */
+    void fill_line(addr_t addr, const line_data_t &line) {
+        if (line.supplied) {
+            transfers++;
+            wait(dir_forward_latency + c2c_latency);
+            return;
+        }
+        memory_reads++;
+        memory_access(addr, false);
+    }
+
+    /* Send req to every cache that may hold the line except writer and
+       leave writer as the only, owning, sharer. */
+    void invalidate(dir_entry_t &e, int writer, addr_t addr, int req, line_data_t *line) {
+        int sent = 0;
+
+        if (pointers && e.overflow) broadcasts++;
+
+        for (int i = 0; i < cpus; i++) {
+            if (i == writer || !is_sharer(e, i)) continue;
+            Port_Snoop[i]->snoop(writer, addr, req, line);
+            sent++;
+        }
+        invalidations += sent;
+
+        // The invalidations travel in parallel
+        if (sent) wait();
+
+        if (!pointers) {
+            e.bits.assign(e.bits.size(), 0);
+        }
+        else {
+            e.ptrs.clear();
+            e.overflow = false;
+        }
+        add_sharer(e, writer);
+        e.owner = writer;
+    }
+};
+
+#endif
@@ -0,0 +1,174 @@
+/*
+// File: host_profiler.h
+//
+// Host time profile of the simulator. The host time is charged to the
+// region the running code is in: a ProfileScope enters a region for its
+// lifetime, and a process that waits leaves its region for the kernel
+// until it resumes. Since the region a process waits in is saved on the
+// process's own stack, the time other processes run while it waits is not
+// charged to it. Time in processes without regions, SC_METHODs included,
+// counts as kernel time.
+//
+// Modules derive from ProfiledModule, whose wait() calls hide the ones of
+// sc_module. While the profiler is off a region change costs one branch.
+*/
+
+#ifndef HOST_PROFILER_H
+#define HOST_PROFILER_H
+
+#include <systemc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+enum ProfileRegion
+{
+    PROF_KERNEL,        // SystemC scheduler and unprofiled processes
+    PROF_CPU,
+    PROF_TRACE,         // reading and parsing the trace
+    PROF_CACHE,
+    PROF_SNOOP,
+    PROF_BUS,           // any interconnect
+    PROF_DRAM,
+    PROF_LOG,           // console output
+    NUM_PROF_REGIONS
+};
+
+class HostProfiler
+{
+public:
+    static void start()
+    {
+        state_t &s = state();
+        s.enabled = true;
+        s.current = PROF_KERNEL;
+        s.started = s.last = now();
+    }
+
+    /* Enter region, returns the region left. */
+    static int enter(int region)
+    {
+        state_t &s = state();
+        if (!s.enabled) return region;
+
+        uint64_t t = now();
+        s.time[s.current] += t - s.last;
+        s.last = t;
+
+        int left = s.current;
+        s.current = region;
+        return left;
+    }
+
+    /* The calling process is about to wait. */
+    static int suspend()
+    {
+        return enter(PROF_KERNEL);
+    }
+
+    /* The process resumes in the region it waited in. */
+    static void resume(int region)
+    {
+        if (!state().enabled) return;
+        enter(region);
+        state().activations[region]++;
+    }
+
+    /* Seconds since start(). */
+    static double elapsed()
+    {
+        return (now() - state().started) / 1e9;
+    }
+
+    /* Throughput so far, for a progress line during the run. */
+    static void progress(long cycles, long entries)
+    {
+        double s = elapsed();
+        fprintf(stderr, "profile: %ld cycles, %ld trace entries in %.1f s; %.0f cycles/s, %.0f entries/s\n",
+                cycles, entries, s, s > 0 ? cycles / s : 0.0, s > 0 ? entries / s : 0.0);
+    }
+
+    static void output(long cycles, long entries)
+    {
+        static const char *names[NUM_PROF_REGIONS] = { "kernel", "cpu", "trace", "cache", "snoop", "bus", "dram", "log" };
+        state_t &s = state();
+
+        enter(PROF_KERNEL);
+        double total = elapsed();
+
+        printf("\n11. Host profile\n");
+        printf("    %f s for %ld cycles and %ld trace entries: %.0f cycles/s, %.0f entries/s.\n",
+               total, cycles, entries, total > 0 ? cycles / total : 0.0, total > 0 ? entries / total : 0.0);
+        printf("    region        time (s)   share %%  activations\n");
+        for (int i = 0; i < NUM_PROF_REGIONS; i++)
+        {
+            printf("    %-8s %13f %9.1f %12ld\n", names[i], s.time[i] / 1e9,
+                   total > 0 ? 100.0 * s.time[i] / 1e9 / total : 0.0, s.activations[i]);
+        }
+    }
+
+private:
+    typedef struct {
+        bool enabled;
+        int current;
+        uint64_t started;
+        uint64_t last;
+        uint64_t time[NUM_PROF_REGIONS];        // ns
+        long activations[NUM_PROF_REGIONS];     // processes resumed in the region
+    } state_t;
+
+    static state_t &state()
+    {
+        static state_t s;
+        return s;
+    }
+
+    static uint64_t now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+};
+
+/* Charges the host time to region while it is in scope. */
+class ProfileScope
+{
+public:
+    ProfileScope(int region) : left(HostProfiler::enter(region)) {}
+    ~ProfileScope() { HostProfiler::enter(left); }
+
+private:
+    int left;
+};
+
+/* Module whose processes wait outside of their region. */
+class ProfiledModule : public sc_module
+{
+protected:
+    ProfiledModule() {}
+    ProfiledModule(sc_module_name name) : sc_module(name) {}
+
+    void wait()
+    {
+        int region = HostProfiler::suspend();
+        sc_module::wait();
+        HostProfiler::resume(region);
+    }
+
+    void wait(int n)
+    {
+        int region = HostProfiler::suspend();
+        sc_module::wait(n);
+        HostProfiler::resume(region);
+    }
+
+    void wait(const sc_event &e)
+    {
+        int region = HostProfiler::suspend();
+        sc_module::wait(e);
+        HostProfiler::resume(region);
+    }
+};
+
+#endif
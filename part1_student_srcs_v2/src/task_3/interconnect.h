@@ -0,0 +1,338 @@
+/*
+// File: interconnect.h
+//
+// Alternatives to the single shared Bus from core.cpp, selected in sc_main:
+// several buses interleaved by line address, and a crossbar from every
+// cache to banked memory. Both keep contention counters per bank.
+*/
+
+#ifndef INTERCONNECT_H
+#define INTERCONNECT_H
+
+/* Default cycles a crossbar memory bank stays busy per request. */
+#define XBAR_BANK_CYCLES    1
+
+/* Cycles a crossbar memory bank stays busy per request, set by sc_main. */
+int xbar_bank_cycles = XBAR_BANK_CYCLES;
+
+/* Line address to bank, consecutive lines go to consecutive banks. */
+static inline int bank_of(addr_t addr, int banks)
+{
+    return (addr / line_size) % banks;
+}
+
+/* Several independent buses. A line is always carried by the same bus, so
+   every bus snoops and orders the requests for its share of the lines.
+   Each bus presents its requests to the caches through their Snoop_if, a
+   cache listening on the signals of a single bus could not sit on all. */
+class BankedBus : public Interconnect, public ProfiledModule
+{
+public:
+    sc_in<bool> Port_CLK;
+
+    std::vector<Bus *> buses;
+
+    /* n buses, each in split-transaction mode when max_inflight > 0 and
+       with a snoop filter of filter_entries when that is > 0. */
+    BankedBus(sc_module_name name, int n, int max_inflight, int filter_entries) : ProfiledModule(name)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            char name_bus[16];
+            sprintf(name_bus, "bus_%d", i);
+
+            Bus *bus = new Bus(name_bus);
+            bus->Port_CLK(Port_CLK);
+            if (max_inflight > 0) bus->split(max_inflight);
+            if (filter_entries > 0) bus->snoop_filter(filter_entries);
+            buses.push_back(bus);
+        }
+    }
+
+    virtual void attach(Snoop_if &cache) {
+        for (size_t i = 0; i < buses.size(); i++) buses[i]->attach(cache);
+    }
+
+    virtual bool Rd(int writer, addr_t addr, line_data_t &line) {
+        return buses[bank_of(addr, buses.size())]->Rd(writer, addr, line);
+    }
+
+    virtual bool Upgr(int writer, addr_t addr, int data) {
+        return buses[bank_of(addr, buses.size())]->Upgr(writer, addr, data);
+    }
+
+    virtual bool RdX(int writer, addr_t addr, line_data_t &line) {
+        return buses[bank_of(addr, buses.size())]->RdX(writer, addr, line);
+    }
+
+    virtual bool Upd(int writer, addr_t addr, int data) {
+        return buses[bank_of(addr, buses.size())]->Upd(writer, addr, data);
+    }
+
+    virtual bool flush(int writer, addr_t addr, uint8_t data[MAX_LINE_SIZE]) {
+        return buses[bank_of(addr, buses.size())]->flush(writer, addr, data);
+    }
+
+    virtual void output(const sc_time &cycle) {
+        long reads = 0, writes = 0, waits = 0;
+        long memory_reads = 0, transfers = 0, writebacks = 0, updates = 0;
+
+        for (size_t i = 0; i < buses.size(); i++)
+        {
+            reads += buses[i]->reads;
+            writes += buses[i]->writes;
+            waits += buses[i]->waits;
+            memory_reads += buses[i]->memory_reads;
+            transfers += buses[i]->transfers;
+            writebacks += buses[i]->writebacks;
+            updates += buses[i]->updates;
+        }
+
+        printf("\n 2. Main memory access rates\n");
+        printf("    Buses had %ld reads and %ld writes.\n", reads, writes);
+        printf("    A total of %ld accesses.\n", reads + writes);
+        printf("    %ld lines came from memory, %ld from another cache; %ld write-backs.\n", memory_reads, transfers, writebacks);
+        printf("    %ld of the writes updated other copies.\n", updates);
+        printf("\n 3. Average time for bus acquisition\n");
+        printf("    There were %ld waits for the buses.\n", waits);
+        printf("    Average waiting time per access: %f cycles.\n", (double)waits / double(reads + writes));
+        printf("\n 4. Contention per bus (%d buses interleaved by line address)\n", (int)buses.size());
+        printf("    bus      reads     writes      waits   avg wait   busy %%\n");
+        for (size_t i = 0; i < buses.size(); i++)
+        {
+            Bus *b = buses[i];
+            printf("    %3d %10ld %10ld %10ld %10f %8.1f\n", (int)i, b->reads, b->writes, b->waits,
+                   b->reads + b->writes ? (double)b->waits / double(b->reads + b->writes) : 0.0,
+                   100.0 * b->busy / (sc_time_stamp() / cycle));
+        }
+        if (buses[0]->timed)
+        {
+            printf("    Buses are %d bytes wide with bursts of %d beats and %d turnaround cycles, %d cycles per line.\n",
+                   buses[0]->width, buses[0]->burst, buses[0]->turnaround, buses[0]->data_cycles(line_size));
+        }
+        printf("    Bandwidth: %f transactions per cycle.\n", (reads + writes) / (sc_time_stamp() / cycle));
+
+        if (buses[0]->filter != NULL)
+        {
+            long probes = 0, filtered = 0, back_invalidations = 0;
+
+            for (size_t i = 0; i < buses.size(); i++)
+            {
+                probes += buses[i]->filter->probes;
+                filtered += buses[i]->filter->filtered;
+                back_invalidations += buses[i]->filter->back_invalidations;
+            }
+            printf("\n 5. Snoop filters\n");
+            printf("    %ld probes sent, %ld filtered (%f%%).\n", probes, filtered,
+                   probes + filtered ? 100.0 * filtered / (probes + filtered) : 0.0);
+            printf("    %ld back-invalidations.\n", back_invalidations);
+        }
+    }
+
+    virtual void watch(StatsExport &stats) {
+        for (size_t i = 0; i < buses.size(); i++)
+        {
+            char prefix[16];
+            sprintf(prefix, "bus.%d", (int)i);
+            buses[i]->watch(stats, prefix);
+        }
+    }
+};
+
+/* Crossbar from every cache to banked memory. Each cache has a private
+   link, so requests only contend when they go to the same memory bank. The
+   home bank of a line orders its requests and forwards them to the other
+   caches for snooping. */
+class Crossbar : public Interconnect, public ProfiledModule
+{
+public:
+    sc_in<bool> Port_CLK;
+
+    /* Snooping caches, in cache_id order. */
+    sc_port<Snoop_if, 0> Port_Snoop;
+
+    /* A memory bank with its contention counters. */
+    typedef struct {
+        sc_mutex *lock;
+        long reads;
+        long writes;
+        long waits;
+    } bank_t;
+
+    std::vector<bank_t> banks;
+
+    /* Line fills from memory and from another cache, the latter bypass
+       the banks, and write-backs of dirty lines. */
+    long memory_reads;
+    long transfers;
+    long writebacks;
+    long updates;
+
+    Crossbar(sc_module_name name, int n) : ProfiledModule(name), banks(n)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            banks[i].lock = new sc_mutex();
+            banks[i].reads = 0;
+            banks[i].writes = 0;
+            banks[i].waits = 0;
+        }
+        memory_reads = 0;
+        transfers = 0;
+        writebacks = 0;
+        updates = 0;
+    }
+
+    virtual void attach(Snoop_if &cache) {
+        Port_Snoop(cache);
+    }
+
+    virtual bool Rd(int writer, addr_t addr, line_data_t &line) {
+        ProfileScope scope(PROF_BUS);
+
+        bank_t &bank = banks[bank_of(addr, banks.size())];
+        bank.reads++;
+
+        line.supplied = false;
+        bool copies = access(bank, writer, addr, Cache::BUS_READ, &line);
+        fill_line(addr, line);
+        return copies;
+    }
+
+    virtual bool Upgr(int writer, addr_t addr, int /* data */) {
+        ProfileScope scope(PROF_BUS);
+
+        bank_t &bank = banks[bank_of(addr, banks.size())];
+        bank.writes++;
+
+        access(bank, writer, addr, Cache::BUS_UPGR, NULL);
+        return false;
+    }
+
+    virtual bool RdX(int writer, addr_t addr, line_data_t &line) {
+        ProfileScope scope(PROF_BUS);
+
+        bank_t &bank = banks[bank_of(addr, banks.size())];
+        bank.reads++;
+
+        line.supplied = false;
+        access(bank, writer, addr, Cache::BUS_READX, &line);
+        fill_line(addr, line);
+        return false;
+    }
+
+    virtual bool Upd(int writer, addr_t addr, int data) {
+        ProfileScope scope(PROF_BUS);
+
+        bank_t &bank = banks[bank_of(addr, banks.size())];
+        bank.writes++;
+        updates++;
+
+        line_data_t word;
+        word.supplied = false;
+        word.data[addr & (line_size - 1)] = (uint8_t)data;
+        return access(bank, writer, addr, Cache::BUS_UPD, &word);
+    }
+
+    virtual bool flush(int /* writer */, addr_t addr, uint8_t /* data */[MAX_LINE_SIZE]) {
+        ProfileScope scope(PROF_BUS);
+
+        bank_t &bank = banks[bank_of(addr, banks.size())];
+        writebacks++;
+
+        /* Only the home bank takes the line, nobody snoops it. */
+        while (bank.lock->trylock() == -1) {
+            bank.waits++;
+            wait();
+        }
+        wait(xbar_bank_cycles);
+        bank.lock->unlock();
+
+        memory_access(addr, true);
+        return true;
+    }
+
+    virtual void output(const sc_time &cycle) {
+        long reads = 0, writes = 0, waits = 0;
+
+        for (size_t i = 0; i < banks.size(); i++)
+        {
+            reads += banks[i].reads;
+            writes += banks[i].writes;
+            waits += banks[i].waits;
+        }
+
+        printf("\n 2. Main memory access rates\n");
+        printf("    Memory banks had %ld reads and %ld writes.\n", reads, writes);
+        printf("    A total of %ld accesses.\n", reads + writes);
+        printf("    %ld lines came from memory, %ld from another cache; %ld write-backs.\n", memory_reads, transfers, writebacks);
+        printf("    %ld of the writes updated other copies.\n", updates);
+        printf("\n 3. Average time for bank acquisition\n");
+        printf("    There were %ld waits for a bank.\n", waits);
+        printf("    Average waiting time per access: %f cycles.\n", (double)waits / double(reads + writes));
+        printf("\n 4. Contention per bank (crossbar to %d memory banks)\n", (int)banks.size());
+        printf("    bank     reads     writes      waits   avg wait\n");
+        for (size_t i = 0; i < banks.size(); i++)
+        {
+            bank_t &b = banks[i];
+            printf("    %4d %9ld %10ld %10ld %10f\n", (int)i, b.reads, b.writes, b.waits,
+                   b.reads + b.writes ? (double)b.waits / double(b.reads + b.writes) : 0.0);
+        }
+        printf("    Bandwidth: %f transactions per cycle.\n", (reads + writes) / (sc_time_stamp() / cycle));
+    }
+
+    virtual void watch(StatsExport &stats) {
+        for (size_t i = 0; i < banks.size(); i++)
+        {
+            char prefix[16];
+            sprintf(prefix, "bank.%d", (int)i);
+            stats.counter(string(prefix) + ".reads", &banks[i].reads);
+            stats.counter(string(prefix) + ".writes", &banks[i].writes);
+            stats.counter(string(prefix) + ".waits", &banks[i].waits);
+        }
+        stats.counter("crossbar.memory_reads", &memory_reads);
+        stats.counter("crossbar.transfers", &transfers);
+        stats.counter("crossbar.writebacks", &writebacks);
+        stats.counter("crossbar.updates", &updates);
+    }
+
+private:
+    /* Win the home bank, have the other caches snoop the request and keep
+       the bank busy. Returns true when a cache kept a copy. */
+    bool access(bank_t &bank, int writer, addr_t addr, int req, line_data_t *line) {
+        while (bank.lock->trylock() == -1) {
+            bank.waits++;
+            wait();
+        }
+
+        // an upgrade or update whose line was taken meanwhile is reissued
+        if ((req == Cache::BUS_UPGR || req == Cache::BUS_UPD) && !Port_Snoop[writer]->holds(addr)) {
+            bank.lock->unlock();
+            return false;
+        }
+
+        bool copies = false;
+        for (int i = 0; i < Port_Snoop.size(); i++) {
+            if (Port_Snoop[i]->snoop(writer, addr, req, line)) copies = true;
+        }
+
+        wait(xbar_bank_cycles);
+        bank.lock->unlock();
+
+        return copies;
+    }
+
+    /* Wait for a line from the cache that supplies it or from memory. A
+       supplied line travels over the private links only. */
+    void fill_line(addr_t addr, const line_data_t &line) {
+        if (line.supplied) {
+            transfers++;
+            wait(c2c_latency);
+            return;
+        }
+        memory_reads++;
+        memory_access(addr, false);
+    }
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+// File: latency.h
+//
+// Log-scale latency histogram for tail percentiles. Values below
+// LAT_SUB_BUCKETS are counted exactly. Above that, every power of two is
+// split into LAT_SUB_BUCKETS buckets, so a percentile, reported as the top
+// of its bucket, is at most 1/LAT_SUB_BUCKETS above the true value.
+*/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+/* Buckets per power of two, a power of two itself. */
+#define LAT_SUB_BITS        3
+#define LAT_SUB_BUCKETS     (1 << LAT_SUB_BITS)
+
+class LatencyHistogram
+{
+public:
+    long count;
+    long sum;
+    long max;
+
+    LatencyHistogram() : count(0), sum(0), max(0) {}
+
+    void add(long value)
+    {
+        size_t b = bucket(value);
+        if (b >= buckets.size()) buckets.resize(b + 1, 0);
+        buckets[b]++;
+
+        count++;
+        sum += value;
+        if (value > max) max = value;
+    }
+
+    void merge(const LatencyHistogram &h)
+    {
+        if (h.buckets.size() > buckets.size()) buckets.resize(h.buckets.size(), 0);
+        for (size_t i = 0; i < h.buckets.size(); i++) buckets[i] += h.buckets[i];
+
+        count += h.count;
+        sum += h.sum;
+        max = std::max(max, h.max);
+    }
+
+    double mean() const
+    {
+        return count ? (double)sum / count : 0.0;
+    }
+
+    /* Smallest bucket top that at least p percent of the values are at or
+       below, 0 when empty. */
+    long percentile(double p) const
+    {
+        long rank = (long)(p / 100.0 * count + 0.999999);
+        long seen = 0;
+
+        if (rank < 1) rank = 1;
+        for (size_t i = 0; i < buckets.size(); i++)
+        {
+            seen += buckets[i];
+            if (seen >= rank) return std::min(top(i), max);
+        }
+        return max;
+    }
+
+private:
+    std::vector<long> buckets;
+
+    static size_t bucket(long value)
+    {
+        if (value < LAT_SUB_BUCKETS) return value < 0 ? 0 : value;
+
+        int exp = 63 - __builtin_clzll(value);
+        int shift = exp - LAT_SUB_BITS;
+        return (shift + 1) * LAT_SUB_BUCKETS + ((value >> shift) - LAT_SUB_BUCKETS);
+    }
+
+    /* Largest value in bucket b. */
+    static long top(size_t b)
+    {
+        if (b < LAT_SUB_BUCKETS) return b;
+
+        int shift = b / LAT_SUB_BUCKETS - 1;
+        long low = (long)(LAT_SUB_BUCKETS + b % LAT_SUB_BUCKETS) << shift;
+        return low + ((long)1 << shift) - 1;
+    }
+};
+
+#endif
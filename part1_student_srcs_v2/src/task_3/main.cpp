@@ -1,38 +1,692 @@
+#define SC_INCLUDE_DYNAMIC_PROCESSES
 #include "systemc.h"
 #include "aca2009.h"
 #include "core.cpp"
+#include "interconnect.h"
+#include "directory.h"
+#include "../common/config_file.h"
+
+/* Options handled by this model, everything else is passed to aca2009. */
+static const char *stream_path = NULL;
+static int stream_cpus = 0;
+static int split_bus = 0;
+static int num_buses = 1;
+static int crossbar_banks = 0;
+static int dir_pointers = -1;
+static int dir_banks = 1;
+static int filter_entries = 0;
+static const char *protocol_name = "moesi";
+static int sharing_top = 0;
+static int bus_width = BUS_WIDTH;
+static int bus_burst = BUS_BURST;
+static int bus_turnaround = BUS_TURNAROUND;
+static bool bus_timing = false;
+static int util_window = 0;
+static const char *dram_timing = NULL;
+static bool dram_frfcfs = true;
+static int dram_queue = DRAM_QUEUE_SIZE;
+static int store_buffer = 0;
+static int ooo_window = 0;
+static int ooo_lanes = OOO_LANES;
+static const char *record_path = NULL;
+static const char *stats_json = NULL;
+static const char *stats_csv = NULL;
+static int stats_interval = 0;
+static const char *live_name = NULL;
+static int live_interval = LIVE_INTERVAL;
+static bool profile = false;
+static int profile_interval = 0;
+static const char *trace_path = NULL;
+static bool trace_binary = false;
+static long trace_start = 0;
+static long trace_length = -1;
+static bool trace_on_miss = false;
+static uint64_t trace_addr = 0;
+static const char *trace_cpus = NULL;
+static const char *trace_signals = NULL;
+
+/* A class of CPUs whose caches have their own parameters, see
+   --core-class. Parameters left at -1 take the global value. */
+typedef struct {
+    string name;
+    string cpus;            // as given, e.g. "0-1,4"
+    int size;
+    int ways;
+    int policy;
+    int hit_latency;
+} core_class_t;
+
+static vector<core_class_t> core_classes;
+
+static const char *replacement_names[] = { "lru", "fifo", "random" };
+
+/* Replacement policy by name, -1 for an unknown one. */
+static int replacement_policy(const char *name)
+{
+    for (int i = 0; i < (int)(sizeof(replacement_names) / sizeof(replacement_names[0])); i++)
+    {
+        if (strcmp(replacement_names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+/* Parse the "<key>=<value>,..." parameters of a core class. Returns false
+   on an unknown key or a bad value. */
+static bool parse_class(core_class_t &c, const char *params)
+{
+    c.size = c.ways = c.policy = c.hit_latency = -1;
+
+    string list = params;
+    for (size_t p = 0; p < list.size(); )
+    {
+        size_t comma = list.find(',', p);
+        if (comma == string::npos) comma = list.size();
+        string item = list.substr(p, comma - p);
+        p = comma + 1;
+
+        size_t eq = item.find('=');
+        if (eq == string::npos) return false;
+        string key = item.substr(0, eq);
+        const char *value = item.c_str() + eq + 1;
+
+        if (key == "cache-size") c.size = atoi(value);
+        else if (key == "associativity") c.ways = atoi(value);
+        else if (key == "hit-latency") c.hit_latency = atoi(value);
+        else if (key == "replacement") c.policy = replacement_policy(value);
+        else return false;
+
+        if ((key == "replacement" && c.policy < 0) || (key != "replacement" && atoi(value) <= 0)) return false;
+    }
+    return true;
+}
+
+/* Fill in the global defaults of the core classes and return the class of
+   every CPU, -1 for none. Throws for a CPU list or a geometry that does
+   not work out. */
+static vector<int> assign_classes()
+{
+    vector<int> classes(num_cpus, -1);
+
+    for (size_t k = 0; k < core_classes.size(); k++)
+    {
+        core_class_t &c = core_classes[k];
+        if (c.size < 0) c.size = cache_size;
+        if (c.ways < 0) c.ways = associativity;
+        if (c.policy < 0) c.policy = replacement;
+        if (c.hit_latency < 0) c.hit_latency = hit_latency;
+
+        if (!Cache::valid_geometry(c.size, c.ways))
+        {
+            throw invalid_argument("Core class " + c.name + ": the number of sets must be a power of two, with at most 255 ways");
+        }
+
+        // CPU numbers and ranges, "0-1,4"
+        for (const char *p = c.cpus.c_str(); *p != '\0'; )
+        {
+            char *end;
+            long first = strtol(p, &end, 10), last = first;
+            if (end != p && *end == '-') last = strtol(end + 1, &end, 10);
+            if (end == p || (*end != ',' && *end != '\0') || first < 0 || last < first || last >= num_cpus)
+            {
+                throw invalid_argument("Core class " + c.name + ": bad CPU list " + c.cpus);
+            }
+            for (long i = first; i <= last; i++)
+            {
+                if (classes[i] >= 0) throw invalid_argument("Core class " + c.name + ": CPU " + c.cpus + " is in two classes");
+                classes[i] = k;
+            }
+            p = *end == ',' ? end + 1 : end;
+        }
+    }
+    return classes;
+}
+
+/* Whether item is in the comma separated list, a NULL list has everything. */
+static bool in_list(const char *list, const char *item)
+{
+    if (list == NULL) return true;
+
+    size_t n = strlen(item);
+    for (const char *p = list; p != NULL; p = strchr(p, ','))
+    {
+        if (*p == ',') p++;
+        if (strncmp(p, item, n) == 0 && (p[n] == ',' || p[n] == '\0')) return true;
+    }
+    return false;
+}
+
+/* Record the utilization of bus every util_window cycles. */
+static void sample_utilization(Bus *bus, sc_clock &clk, const char *name)
+{
+    BusSampler *sampler = new BusSampler(name);
+    sampler->Port_CLK(clk);
+    sampler->bus = bus;
+    bus->util_window = util_window;
+}
+
+/* One row of the latency report. */
+static void latency_row(const char *name, const LatencyHistogram &h)
+{
+    printf("    %-14s %9ld %9.2f %7ld %7ld %7ld %7ld\n", name, h.count, h.mean(),
+           h.percentile(50), h.percentile(90), h.percentile(99), h.max);
+}
+
+typedef vector< pair<string, string> > config_t;
+
+static void param(config_t &config, const char *name, const string &value)
+{
+    config.push_back(make_pair(string(name), value));
+}
+
+static void param(config_t &config, const char *name, long value)
+{
+    char text[24];
+    sprintf(text, "%ld", value);
+    param(config, name, string(text));
+}
+
+/* The parameters of the run, as options, echoed with the statistics. */
+static config_t configuration(const Protocol &protocol)
+{
+    config_t config;
+
+    param(config, "cpus", num_cpus);
+    param(config, "protocol", protocol.name);
+    param(config, "cache-size", cache_size);
+    param(config, "associativity", associativity);
+    param(config, "line-size", line_size);
+    param(config, "replacement", replacement_names[replacement]);
+    param(config, "hit-latency", hit_latency);
+    param(config, "rmw-cycles", rmw_cycles);
+    param(config, "c2c-latency", c2c_latency);
+    if (dram_timing != NULL)
+    {
+        param(config, "dram", dram_timing);
+        param(config, "dram-sched", dram_frfcfs ? "frfcfs" : "fcfs");
+        param(config, "dram-queue", dram_queue);
+    }
+    else param(config, "mem-latency", mem_latency);
+
+    if (dir_pointers >= 0)
+    {
+        if (dir_pointers > 0) param(config, "directory", dir_pointers);
+        else param(config, "directory", "full");
+        param(config, "dir-banks", dir_banks);
+        param(config, "dir-latency", dir_latency);
+        param(config, "dir-forward-latency", dir_forward_latency);
+    }
+    else if (crossbar_banks > 0)
+    {
+        param(config, "crossbar", crossbar_banks);
+        param(config, "xbar-cycles", xbar_bank_cycles);
+    }
+    else
+    {
+        param(config, "buses", num_buses);
+        if (bus_timing)
+        {
+            param(config, "bus-width", bus_width);
+            param(config, "burst", bus_burst);
+            param(config, "turnaround", bus_turnaround);
+        }
+        if (split_bus > 0) param(config, "split-bus", split_bus);
+        if (filter_entries > 0) param(config, "snoop-filter", filter_entries);
+    }
+
+    if (ooo_window > 0)
+    {
+        param(config, "ooo", ooo_window);
+        param(config, "ooo-lanes", ooo_lanes);
+        param(config, "ooo-width", ooo_width);
+    }
+    else if (store_buffer > 0) param(config, "store-buffer", store_buffer);
+
+    for (size_t k = 0; k < core_classes.size(); k++)
+    {
+        const core_class_t &c = core_classes[k];
+        ostringstream text;
+        text << "cpus " << c.cpus << ", cache-size " << c.size << ", associativity " << c.ways
+             << ", replacement " << replacement_names[c.policy] << ", hit-latency " << c.hit_latency;
+        param(config, ("core-class " + c.name).c_str(), text.str());
+    }
+    return config;
+}
+
+/* Take our own options out of argv. Returns false on a malformed option. */
+static bool parse_options(int *argc, char ***argv)
+{
+    char **args = *argv;
+    int n = 1;
+
+    for (int i = 1; i < *argc; i++)
+    {
+        if (strcmp(args[i], "--stream") == 0)
+        {
+            // Read the trace incrementally from a pipe, FIFO or stdin ("-")
+            // instead of letting aca2009 load a trace file
+            if (i + 2 >= *argc) return false;
+            stream_path = args[++i];
+            stream_cpus = atoi(args[++i]);
+            if (stream_cpus <= 0) return false;
+        }
+        else if (strcmp(args[i], "--split-bus") == 0)
+        {
+            // Split-transaction bus with this many outstanding requests
+            if (i + 1 >= *argc) return false;
+            split_bus = atoi(args[++i]);
+            if (split_bus <= 0) return false;
+        }
+        else if (strcmp(args[i], "--buses") == 0)
+        {
+            // Several buses interleaved by line address
+            if (i + 1 >= *argc) return false;
+            num_buses = atoi(args[++i]);
+            if (num_buses <= 0) return false;
+        }
+        else if (strcmp(args[i], "--crossbar") == 0)
+        {
+            // Crossbar to this many memory banks instead of a bus
+            if (i + 1 >= *argc) return false;
+            crossbar_banks = atoi(args[++i]);
+            if (crossbar_banks <= 0) return false;
+        }
+        else if (strcmp(args[i], "--snoop-filter") == 0)
+        {
+            // Snoop filter tracking this many lines per bus
+            if (i + 1 >= *argc) return false;
+            filter_entries = atoi(args[++i]);
+            if (filter_entries <= 0) return false;
+        }
+        else if (strcmp(args[i], "--directory") == 0)
+        {
+            // Directory coherence, "full" bit vector or this many pointers
+            if (i + 1 >= *argc) return false;
+            i++;
+            dir_pointers = strcmp(args[i], "full") == 0 ? 0 : atoi(args[i]);
+            if (dir_pointers <= 0 && strcmp(args[i], "full") != 0) return false;
+        }
+        else if (strcmp(args[i], "--dir-banks") == 0)
+        {
+            // Number of home directory banks
+            if (i + 1 >= *argc) return false;
+            dir_banks = atoi(args[++i]);
+            if (dir_banks <= 0) return false;
+        }
+        else if (strcmp(args[i], "--protocol") == 0)
+        {
+            // Coherence protocol: msi, mesi, moesi, mesif, dragon or firefly
+            if (i + 1 >= *argc) return false;
+            protocol_name = args[++i];
+        }
+        else if (strcmp(args[i], "--cache-size") == 0)
+        {
+            // Cache size in bytes
+            if (i + 1 >= *argc) return false;
+            cache_size = atoi(args[++i]);
+            if (cache_size <= 0) return false;
+        }
+        else if (strcmp(args[i], "--associativity") == 0)
+        {
+            // Ways per set
+            if (i + 1 >= *argc) return false;
+            associativity = atoi(args[++i]);
+            if (associativity <= 0) return false;
+        }
+        else if (strcmp(args[i], "--line-size") == 0)
+        {
+            // Line size in bytes
+            if (i + 1 >= *argc) return false;
+            line_size = atoi(args[++i]);
+            if (line_size <= 0) return false;
+        }
+        else if (strcmp(args[i], "--hit-latency") == 0)
+        {
+            // Cycles for a cache hit
+            if (i + 1 >= *argc) return false;
+            hit_latency = atoi(args[++i]);
+            if (hit_latency <= 0) return false;
+        }
+        else if (strcmp(args[i], "--mem-latency") == 0)
+        {
+            // Cycles for main memory to return a line, without --dram
+            if (i + 1 >= *argc) return false;
+            mem_latency = atoi(args[++i]);
+            if (mem_latency <= 0) return false;
+        }
+        else if (strcmp(args[i], "--rmw-cycles") == 0)
+        {
+            // Cycles an atomic read-modify-write locks its line
+            if (i + 1 >= *argc) return false;
+            rmw_cycles = atoi(args[++i]);
+            if (rmw_cycles <= 0) return false;
+        }
+        else if (strcmp(args[i], "--ooo-width") == 0)
+        {
+            // Entries an out-of-order CPU dispatches and retires per cycle
+            if (i + 1 >= *argc) return false;
+            ooo_width = atoi(args[++i]);
+            if (ooo_width <= 0) return false;
+        }
+        else if (strcmp(args[i], "--dir-latency") == 0)
+        {
+            // Cycles for a directory lookup
+            if (i + 1 >= *argc) return false;
+            dir_latency = atoi(args[++i]);
+            if (dir_latency <= 0) return false;
+        }
+        else if (strcmp(args[i], "--dir-forward-latency") == 0)
+        {
+            // Cycles to forward a request from the directory to the owner
+            if (i + 1 >= *argc) return false;
+            dir_forward_latency = atoi(args[++i]);
+            if (dir_forward_latency < 0) return false;
+        }
+        else if (strcmp(args[i], "--xbar-cycles") == 0)
+        {
+            // Cycles a crossbar bank is busy per request
+            if (i + 1 >= *argc) return false;
+            xbar_bank_cycles = atoi(args[++i]);
+            if (xbar_bank_cycles <= 0) return false;
+        }
+        else if (strcmp(args[i], "--replacement") == 0)
+        {
+            // Replacement policy: lru, fifo or random
+            if (i + 1 >= *argc) return false;
+            replacement = replacement_policy(args[++i]);
+            if (replacement < 0) return false;
+        }
+        else if (strcmp(args[i], "--core-class") == 0)
+        {
+            // CPUs whose caches have their own size, ways, policy and hit latency
+            if (i + 3 >= *argc) return false;
+            core_class_t c;
+            c.name = args[++i];
+            c.cpus = args[++i];
+            if (!parse_class(c, args[++i])) return false;
+            core_classes.push_back(c);
+        }
+        else if (strcmp(args[i], "--c2c-latency") == 0)
+        {
+            // Cycles for a cache to supply a line to another cache
+            if (i + 1 >= *argc) return false;
+            c2c_latency = atoi(args[++i]);
+            if (c2c_latency <= 0) return false;
+        }
+        else if (strcmp(args[i], "--sharing-report") == 0)
+        {
+            // Report false sharing and this many of the most contended lines
+            if (i + 1 >= *argc) return false;
+            sharing_top = atoi(args[++i]);
+            if (sharing_top <= 0) return false;
+        }
+        else if (strcmp(args[i], "--bus-width") == 0)
+        {
+            // Bytes per data beat
+            if (i + 1 >= *argc) return false;
+            bus_width = atoi(args[++i]);
+            bus_timing = true;
+            if (bus_width <= 0) return false;
+        }
+        else if (strcmp(args[i], "--burst") == 0)
+        {
+            // Beats per burst
+            if (i + 1 >= *argc) return false;
+            bus_burst = atoi(args[++i]);
+            bus_timing = true;
+            if (bus_burst <= 0) return false;
+        }
+        else if (strcmp(args[i], "--turnaround") == 0)
+        {
+            // Idle cycles after every burst
+            if (i + 1 >= *argc) return false;
+            bus_turnaround = atoi(args[++i]);
+            bus_timing = true;
+            if (bus_turnaround < 0) return false;
+        }
+        else if (strcmp(args[i], "--util-window") == 0)
+        {
+            // Report bus utilization per this many cycles
+            if (i + 1 >= *argc) return false;
+            util_window = atoi(args[++i]);
+            if (util_window <= 0) return false;
+        }
+        else if (strcmp(args[i], "--dram") == 0)
+        {
+            // DRAM controller with GPGPU-Sim style timing, or "default"
+            if (i + 1 >= *argc) return false;
+            i++;
+            dram_timing = strcmp(args[i], "default") == 0 ? DRAM_TIMING : args[i];
+        }
+        else if (strcmp(args[i], "--dram-sched") == 0)
+        {
+            // DRAM scheduling policy, fcfs or frfcfs
+            if (i + 1 >= *argc) return false;
+            i++;
+            if (strcmp(args[i], "fcfs") == 0) dram_frfcfs = false;
+            else if (strcmp(args[i], "frfcfs") == 0) dram_frfcfs = true;
+            else return false;
+        }
+        else if (strcmp(args[i], "--dram-queue") == 0)
+        {
+            // DRAM scheduler queue entries
+            if (i + 1 >= *argc) return false;
+            dram_queue = atoi(args[++i]);
+            if (dram_queue <= 0) return false;
+        }
+        else if (strcmp(args[i], "--store-buffer") == 0)
+        {
+            // TSO store buffer with this many entries per CPU
+            if (i + 1 >= *argc) return false;
+            store_buffer = atoi(args[++i]);
+            if (store_buffer <= 0) return false;
+        }
+        else if (strcmp(args[i], "--stats-json") == 0)
+        {
+            // Counters as JSON, see common/stats_export.h
+            if (i + 1 >= *argc) return false;
+            stats_json = args[++i];
+        }
+        else if (strcmp(args[i], "--stats-csv") == 0)
+        {
+            // Counters as CSV, one row per sample
+            if (i + 1 >= *argc) return false;
+            stats_csv = args[++i];
+        }
+        else if (strcmp(args[i], "--stats-interval") == 0)
+        {
+            // Sample the counters every this many cycles
+            if (i + 1 >= *argc) return false;
+            stats_interval = atoi(args[++i]);
+            if (stats_interval <= 0) return false;
+        }
+        else if (strcmp(args[i], "--live") == 0)
+        {
+            // Live counters in this shared memory segment, see tools/live_view
+            if (i + 1 >= *argc) return false;
+            live_name = args[++i];
+        }
+        else if (strcmp(args[i], "--live-interval") == 0)
+        {
+            // Update the live counters every this many cycles
+            if (i + 1 >= *argc) return false;
+            live_interval = atoi(args[++i]);
+            if (live_interval <= 0) return false;
+        }
+        else if (strcmp(args[i], "--profile") == 0)
+        {
+            // Host time profile of the simulator itself
+            profile = true;
+        }
+        else if (strcmp(args[i], "--profile-interval") == 0)
+        {
+            // Report the host throughput every this many cycles
+            if (i + 1 >= *argc) return false;
+            profile = true;
+            profile_interval = atoi(args[++i]);
+            if (profile_interval <= 0) return false;
+        }
+        else if (strcmp(args[i], "--trace") == 0)
+        {
+            // Waveform as VCD, or in the binary format of wave_tracer.h
+            if (i + 1 >= *argc) return false;
+            trace_path = args[++i];
+        }
+        else if (strcmp(args[i], "--trace-binary") == 0)
+        {
+            trace_binary = true;
+        }
+        else if (strcmp(args[i], "--trace-window") == 0)
+        {
+            // Trace this many cycles from this cycle on
+            if (i + 2 >= *argc) return false;
+            trace_start = atol(args[++i]);
+            trace_length = atol(args[++i]);
+            if (trace_start < 0 || trace_length <= 0) return false;
+        }
+        else if (strcmp(args[i], "--trace-miss") == 0)
+        {
+            // Trace this many cycles from the first miss on the line of an address
+            if (i + 2 >= *argc) return false;
+            trace_on_miss = true;
+            trace_addr = strtoull(args[++i], NULL, 0);
+            trace_length = atol(args[++i]);
+            if (trace_length <= 0) return false;
+        }
+        else if (strcmp(args[i], "--trace-cpus") == 0)
+        {
+            // Comma separated CPU numbers
+            if (i + 1 >= *argc) return false;
+            trace_cpus = args[++i];
+        }
+        else if (strcmp(args[i], "--trace-signals") == 0)
+        {
+            // Comma separated from bus, hit, addr, set, line and wr
+            if (i + 1 >= *argc) return false;
+            trace_signals = args[++i];
+        }
+        else if (strcmp(args[i], "--records") == 0)
+        {
+            // Binary event records, see common/log.h
+            if (i + 1 >= *argc) return false;
+            record_path = args[++i];
+        }
+        else if (strcmp(args[i], "--ooo") == 0)
+        {
+            // Out-of-order CPUs with this many window entries
+            if (i + 1 >= *argc) return false;
+            ooo_window = atoi(args[++i]);
+            if (ooo_window <= 0) return false;
+        }
+        else if (strcmp(args[i], "--ooo-lanes") == 0)
+        {
+            // Accesses each out-of-order CPU keeps in flight
+            if (i + 1 >= *argc) return false;
+            ooo_lanes = atoi(args[++i]);
+            if (ooo_lanes <= 0) return false;
+        }
+        else
+        {
+            args[n++] = args[i];
+        }
+    }
+
+    *argc = n;
+    args[n] = NULL;
+
+    // One interconnect, and the bus options only with a bus
+    bool bus = crossbar_banks == 0 && dir_pointers < 0;
+    if ((num_buses > 1) + (crossbar_banks > 0) + (dir_pointers >= 0) > 1) return false;
+    if (!bus && (split_bus > 0 || filter_entries > 0 || bus_timing || util_window > 0)) return false;
+    if (dir_pointers < 0 && dir_banks != 1) return false;
+
+    // An out-of-order CPU has no store buffer
+    return store_buffer == 0 || ooo_window == 0;
+}
 
 int sc_main(int argc, char* argv[])
 {
     try
     {
-        // Get the tracefile argument and create Tracefile object
-        // This function sets tracefile_ptr and num_cpus
-        init_tracefile(&argc, &argv);
+        // The command line goes into the stats files
+        string command = argv[0];
+        for (int i = 1; i < argc; i++) command += string(" ") + argv[i];
+
+        ConfigFile config_file;
+        config_file.apply(&argc, &argv);
+
+        if (!parse_options(&argc, &argv))
+        {
+            cerr << "usage: " << argv[0] << " [--stream <path|-> <num_cpus>] [--records <path>]"
+                 << " [--stats-json <path>] [--stats-csv <path>] [--stats-interval <cycles>]"
+                 << " [--live </name> [--live-interval <cycles>]] [--profile] [--profile-interval <cycles>]"
+                 << " [--trace <path> [--trace-binary] [--trace-window <start> <cycles> | --trace-miss <addr> <cycles>]"
+                 << " [--trace-cpus <list>] [--trace-signals <bus,hit,addr,set,line,wr>]]"
+                 << " [--store-buffer <entries> | --ooo <window> [--ooo-lanes <n>]]"
+                 << " [--protocol <msi|mesi|moesi|mesif|dragon|firefly>] [--c2c-latency <cycles>] [--sharing-report <lines>]"
+                 << " [--split-bus <max_inflight>] [--snoop-filter <entries>]"
+                 << " [--bus-width <bytes>] [--burst <beats>] [--turnaround <cycles>] [--util-window <cycles>]"
+                 << " [--dram <timing|default> [--dram-sched <fcfs|frfcfs>] [--dram-queue <n>]]"
+                 << " [--buses <n> | --crossbar <banks> | --directory <full|pointers> [--dir-banks <n>]]"
+                 << " [--config <path>] [--cache-size <bytes>] [--associativity <ways>] [--line-size <bytes>]"
+                 << " [--hit-latency <cycles>] [--mem-latency <cycles>] [--rmw-cycles <cycles>] [--ooo-width <entries>]"
+                 << " [--dir-latency <cycles>] [--dir-forward-latency <cycles>] [--xbar-cycles <cycles>]"
+                 << " [--replacement <lru|fifo|random>] [--core-class <name> <cpus> <cache-size=..,associativity=..,replacement=..,hit-latency=..>]..."
+                 << " [tracefile]" << endl;
+            return 1;
+        }
+
+        // What is left of the config file was not one of our options
+        for (int i = 1; i < argc; i++)
+        {
+            const char *origin = config_file.origin(argv[i]);
+            if (origin != NULL) throw invalid_argument(string(origin) + ": unknown option " + argv[i]);
+        }
+        if (!Cache::valid_geometry(cache_size, associativity))
+        {
+            ostringstream text;
+            text << "Cache size " << cache_size << " with " << associativity << " ways of " << line_size
+                 << " byte lines: the line size and the number of sets must be powers of two, with at most 255 ways and "
+                 << MAX_LINE_SIZE << " byte lines";
+            throw invalid_argument(text.str());
+        }
+
+        if (stream_path != NULL)
+        {
+            num_cpus = stream_cpus;
+            streamtrace_ptr = new StreamTrace(stream_path, num_cpus);
+        }
+        else
+        {
+            // Get the tracefile argument and create Tracefile object
+            // This function sets tracefile_ptr and num_cpus
+            init_tracefile(&argc, &argv);
+        }
 
         // Initialize statistics counters
         stats_init();
+        if (sharing_top > 0) sharing_ptr = new SharingProfiler(line_size);
 
-        cout << "Number of CPUs: " << num_cpus << endl;
+        // Throws for an unknown protocol name
+        const Protocol &protocol = Protocol::get(protocol_name);
+
+        LOG_INFO("Number of CPUs: " << num_cpus);
+        LOG_INFO("Coherence protocol: " << protocol.name);
+        vector<int> cpu_class = assign_classes();
+        config_t config = configuration(protocol);
 
         // Instantiate Modules
-        Bus     bus("bus");
         Cache* cache[num_cpus];
         CPU*    cpu[num_cpus];
 
         // Signals
         sc_buffer<Cache::Function> *sigMemFunc = new sc_buffer<Cache::Function>[num_cpus];
         sc_buffer<Cache::RetCode>  *sigMemDone = new sc_buffer<Cache::RetCode>[num_cpus];
-        sc_signal<int>              *sigMemAddr = new sc_signal<int>[num_cpus];
+        sc_signal<addr_t>           *sigMemAddr = new sc_signal<addr_t>[num_cpus];
         sc_signal_rv<8>             *sigMemData = new sc_signal_rv<8>[num_cpus];
 
-        // Signals Cache-Bus
-        sc_signal<int>              sigBusWriter;
-        sc_signal<int> sigBusValid;
-
         // Signals for waveforms
         // hit: clock, address, set number, line number
-        sc_signal<uint8_t>  *sigSet = new sc_signal<uint8_t>[num_cpus];
+        sc_signal<uint32_t> *sigSet = new sc_signal<uint32_t>[num_cpus];
         sc_signal<uint8_t>  *sigLine = new sc_signal<uint8_t>[num_cpus];
         sc_signal<bool>     *sigHit = new sc_signal<bool>[num_cpus];
         sc_signal<bool>     *sigWR = new sc_signal<bool>[num_cpus];
@@ -42,10 +696,54 @@ int sc_main(int argc, char* argv[])
 
         // The clock that will drive the CPU and Cache
         sc_clock clk;
+        cycle_time = clk.period();
 
-        bus.Port_CLK(clk);
-        bus.Port_BusWriter(sigBusWriter);
-        bus.Port_BusReq(sigBusValid);
+        // Main memory, a fixed latency unless DRAM timing is given
+        if (dram_timing != NULL)
+        {
+            memctrl_ptr = new MemoryController("memctrl", MemoryController::parse_timing(dram_timing), dram_frfcfs, dram_queue);
+            memctrl_ptr->Port_CLK(clk);
+        }
+
+        // The interconnect between the caches and memory
+        Interconnect *bus;
+        Bus *single_bus = NULL;
+
+        if (dir_pointers >= 0)
+        {
+            Directory *dir = new Directory("directory", num_cpus, dir_banks, dir_pointers);
+            dir->Port_CLK(clk);
+            bus = dir;
+        }
+        else if (crossbar_banks > 0)
+        {
+            Crossbar *xbar = new Crossbar("crossbar", crossbar_banks);
+            xbar->Port_CLK(clk);
+            bus = xbar;
+        }
+        else if (num_buses > 1)
+        {
+            BankedBus *buses = new BankedBus("buses", num_buses, split_bus, filter_entries);
+            buses->Port_CLK(clk);
+            for (int i = 0; i < num_buses; i++)
+            {
+                char name[24];
+                sprintf(name, "bus_sampler_%d", i);
+                if (bus_timing) buses->buses[i]->timing(bus_width, bus_burst, bus_turnaround);
+                if (util_window > 0) sample_utilization(buses->buses[i], clk, name);
+            }
+            bus = buses;
+        }
+        else
+        {
+            single_bus = new Bus("bus");
+            single_bus->Port_CLK(clk);
+            if (split_bus > 0) single_bus->split(split_bus);
+            if (filter_entries > 0) single_bus->snoop_filter(filter_entries);
+            if (bus_timing) single_bus->timing(bus_width, bus_burst, bus_turnaround);
+            if (util_window > 0) sample_utilization(single_bus, clk, "bus_sampler");
+            bus = single_bus;
+        }
 
         /* Create and connect all caches and cpu's. */
         for(int i = 0; i < num_cpus; i++)
@@ -67,14 +765,20 @@ int sc_main(int argc, char* argv[])
 
             /* Set ID's. */
             cpu[i]->cpu_id = i;
+            if (store_buffer > 0) cpu[i]->store_buffer(store_buffer);
+            if (ooo_window > 0) cpu[i]->out_of_order(ooo_window, ooo_lanes);
             cache[i]->cache_id = i;
+            cache[i]->protocol = &protocol;
+            if (cpu_class[i] >= 0)
+            {
+                const core_class_t &c = core_classes[cpu_class[i]];
+                cache[i]->configure(c.size, c.ways, c.policy, c.hit_latency);
+            }
             //cache[i]->snooping = snooping;
 
             /* Cache to Bus. */
-            cache[i]->Port_BusAddr(bus.Port_BusAddr);
-            cache[i]->Port_BusWriter(sigBusWriter);
-            cache[i]->Port_BusReq(sigBusValid);
-            cache[i]->Port_Bus(bus);
+            cache[i]->Port_Bus(*bus);
+            bus->attach(*cache[i]);
 
             /* Cache to CPU. */
             cache[i]->Port_Func(sigMemFunc[i]);
@@ -87,6 +791,7 @@ int sc_main(int argc, char* argv[])
             cpu[i]->Port_MemAddr(sigMemAddr[i]);
             cpu[i]->Port_MemData(sigMemData[i]);
             cpu[i]->Port_MemDone(sigMemDone[i]);
+            cpu[i]->Port_Cache(*cache[i]);
 
             cache[i]->Set_No(sigSet[i]);
             cache[i]->Line_No(sigLine[i]);
@@ -98,41 +803,235 @@ int sc_main(int argc, char* argv[])
             cpu[i]->Port_CLK(clk);
         }
 
-        // Open VCD file
-        sc_trace_file *wf = sc_create_vcd_trace_file("final_cache");
-        sc_trace(wf, clk, "clock");
-        sc_trace(wf, sigBusValid, "bus_request");
-        sc_trace(wf, sigBusWriter, "bus_writer");
+        // Waveform, only for the selected window, CPUs and signals
+        if (trace_path != NULL)
+        {
+            tracer_ptr = new WaveTracer("tracer", trace_path, trace_binary);
+            tracer_ptr->Port_CLK(clk);
+            if (trace_on_miss) tracer_ptr->trigger(trace_addr / line_size, trace_length);
+            else tracer_ptr->window(trace_start, trace_length);
+
+            if (single_bus != NULL && in_list(trace_signals, "bus"))
+            {
+                tracer_ptr->add("bus_request", single_bus->Port_BusReq, 8);
+                tracer_ptr->add("bus_writer", single_bus->Port_BusWriter, 16);
+            }
+
+            for(int i = 0; i < num_cpus; i++){
+                char name[16];
+
+                sprintf(name, "%d", i);
+                if (!in_list(trace_cpus, name)) continue;
+
+                // Dump the desired signals
+                sprintf(name, "hit/miss(%d)", i);
+                if (in_list(trace_signals, "hit")) tracer_ptr->add(name, sigHit[i], 1);
+                sprintf(name, "address(%d)", i);
+                if (in_list(trace_signals, "addr")) tracer_ptr->add(name, sigMemAddr[i], ADDR_BITS);
+                sprintf(name, "set_num(%d)", i);
+                if (in_list(trace_signals, "set")) tracer_ptr->add(name, sigSet[i], 32);
+                sprintf(name, "line_num(%d)", i);
+                if (in_list(trace_signals, "line")) tracer_ptr->add(name, sigLine[i], 8);
+                sprintf(name, "write/read(%d)", i);
+                if (in_list(trace_signals, "wr")) tracer_ptr->add(name, sigWR[i], 1);
+            }
+        }
+
+        // Counters for the stats files and the live counters
+        StatsExport stats;
+        LiveCounters live;
+        if (stats_json != NULL || stats_csv != NULL || live_name != NULL)
+        {
+            char prefix[16];
+
+            stats.info("command", command);
+            for (size_t i = 0; i < config.size(); i++) stats.info(config[i].first, config[i].second);
+            for (int i = 0; i < num_cpus; i++)
+            {
+                sprintf(prefix, "cpu.%d", i);
+                cpu[i]->watch(stats, prefix);
+                sprintf(prefix, "cache.%d", i);
+                cache[i]->watch(stats, prefix);
+                if (cpu_class[i] >= 0) stats.info(string(prefix) + ".class", core_classes[cpu_class[i]].name);
+            }
+            bus->watch(stats);
+            if (memctrl_ptr != NULL) memctrl_ptr->watch(stats);
+
+            if (stats_interval > 0)
+            {
+                StatsSampler *sampler = new StatsSampler("stats_sampler");
+                sampler->Port_CLK(clk);
+                sampler->stats = &stats;
+                sampler->interval = stats_interval;
+                stats.sample_interval(stats_interval);
+            }
+        }
+
+        if (live_name != NULL)
+        {
+            if (!live.open(live_name, stats)) throw runtime_error(string("cannot create shared memory ") + live_name);
 
-        for(int i = 0; i < num_cpus; i++){
-            char name_memaddr[12];
-            char name_set[12];
-            char name_line[12];
-            char name_hitmiss[12];
-            char name_writeread[14];
+            LivePublisher *publisher = new LivePublisher("live_publisher");
+            publisher->Port_CLK(clk);
+            publisher->live = &live;
+            publisher->interval = live_interval;
+        }
 
-            sprintf(name_memaddr, "address(%d)", i);
-            sprintf(name_set, "set_num(%d)", i);
-            sprintf(name_line, "line_num(%d)", i);
-            sprintf(name_hitmiss, "hit/miss(%d)", i);
-            sprintf(name_writeread, "write/read(%d)", i);
+        if (record_path != NULL && !EventLog::open(record_path))
+        {
+            throw runtime_error(string("cannot create ") + record_path);
+        }
 
-            // Dump the desired signals
-            sc_trace(wf, sigHit[i], name_hitmiss);
-            sc_trace(wf, sigMemAddr[i], name_memaddr);
-            sc_trace(wf, sigSet[i], name_set);
-            sc_trace(wf, sigLine[i], name_line);
-            sc_trace(wf, sigWR[i], name_writeread);
+        if (profile_interval > 0)
+        {
+            ProfileReporter *reporter = new ProfileReporter("profile_reporter");
+            reporter->Port_CLK(clk);
+            reporter->interval = profile_interval;
         }
 
-        cout << "Running (press CTRL+C to interrupt)... " << endl;
+        LOG_INFO("Running (press CTRL+C to interrupt)... ");
 
         // Start Simulation
+        if (profile) HostProfiler::start();
         sc_start();
+        EventLog::close();
+
+        long cycles = sc_time_stamp() / clk.period();
+        live.update(cycles);
+        live.close();
+        if (stats_json != NULL && !stats.write_json(stats_json, cycles)) cerr << "cannot write " << stats_json << endl;
+        if (stats_csv != NULL && !stats.write_csv(stats_csv, cycles)) cerr << "cannot write " << stats_csv << endl;
 
         // Print statistics after simulation finished
+        printf("\nConfiguration\n");
+        for (size_t i = 0; i < config.size(); i++) printf("    %-20s %s\n", config[i].first.c_str(), config[i].second.c_str());
         stats_print();
-        sc_close_vcd_trace_file(wf);
+        bus->output(clk.period());
+        if (sharing_ptr != NULL)
+        {
+            printf("\n 6. Coherence hotspots\n");
+            for (int i = 0; i < num_cpus; i++)
+            {
+                printf("    Cache %d snooped %ld reads and %ld writes.\n", i, cache[i]->probeRead, cache[i]->probeWrite);
+            }
+            sharing_ptr->output(sharing_top);
+        }
+
+        long rmws = 0, lls = 0, scs = 0;
+        for (int i = 0; i < num_cpus; i++)
+        {
+            rmws += cache[i]->rmws;
+            lls += cache[i]->lls;
+            scs += cache[i]->scs;
+        }
+        if (rmws + lls + scs > 0)
+        {
+            printf("\n 7. Atomics\n");
+            printf("    cache       rmw        ll        sc  sc failed  rmw stalls\n");
+            for (int i = 0; i < num_cpus; i++)
+            {
+                Cache *c = cache[i];
+                printf("    %5d %9ld %9ld %9ld %10ld %11ld\n", i, c->rmws, c->lls, c->scs, c->sc_failures, c->rmw_stalls);
+            }
+        }
+        if (memctrl_ptr != NULL) memctrl_ptr->output();
+
+        printf("\n 9. CPU timing (%s)\n", ooo_window > 0 ? "out of order" : store_buffer > 0 ? "TSO store buffer" : "blocking stores");
+        printf("    cpu   entries      cycles       CPI       IPC   forwards  sb stalls  fence stalls\n");
+        for (int i = 0; i < num_cpus; i++)
+        {
+            CPU *c = cpu[i];
+            double cycles = c->finished / clk.period();
+            printf("    %3d %9ld %11.0f %9f %9f %10ld %10ld %13ld\n", i, c->instructions, cycles,
+                   c->instructions ? cycles / c->instructions : 0.0, cycles > 0 ? c->instructions / cycles : 0.0,
+                   c->forwards, c->sb_full_stalls, c->fence_stalls);
+        }
+        if (ooo_window > 0)
+        {
+            // MLP: accesses in flight in the cycles that had any
+            printf("    Window of %d entries, %d lanes, %d entries per cycle:\n", ooo_window, ooo_lanes, ooo_width);
+            printf("    cpu       MLP  window stalls  order stalls  mshr waits\n");
+            for (int i = 0; i < num_cpus; i++)
+            {
+                CPU *c = cpu[i];
+                printf("    %3d %9f %14ld %13ld %11ld\n", i, c->mem_cycles ? (double)c->lane_cycles / c->mem_cycles : 0.0,
+                       c->window_stalls, c->order_stalls, cache[i]->mshr_waits);
+            }
+        }
+
+        // Latency of the requests from CPU to cache, per CPU and per kind
+        LatencyHistogram kinds[2][Protocol::NUM_ACTIONS];
+        printf("\n10. Request latency (cycles)\n");
+        printf("    %-14s %9s %9s %7s %7s %7s %7s\n", "", "requests", "mean", "p50", "p90", "p99", "max");
+        for (int i = 0; i < num_cpus; i++)
+        {
+            LatencyHistogram all;
+            for (int w = 0; w < 2; w++)
+            {
+                for (int a = 0; a < Protocol::NUM_ACTIONS; a++)
+                {
+                    all.merge(cache[i]->latency[w][a]);
+                    kinds[w][a].merge(cache[i]->latency[w][a]);
+                }
+            }
+            char name[16];
+            sprintf(name, "cpu %d", i);
+            latency_row(name, all);
+        }
+        for (int w = 0; w < 2; w++)
+        {
+            for (int a = 0; a < Protocol::NUM_ACTIONS; a++)
+            {
+                if (kinds[w][a].count == 0) continue;
+                // a request without bus action hit in the cache
+                char name[24];
+                sprintf(name, "%s %s", w ? "write" : "read", a == Protocol::NONE ? "hit" : Protocol::action_name(a));
+                latency_row(name, kinds[w][a]);
+            }
+        }
+
+        if (profile) HostProfiler::output(cycles, trace_entries);
+
+        if (!core_classes.empty())
+        {
+            printf("\n12. Core classes\n");
+            printf("    %-10s %-10s %9s %5s %-7s %4s %10s %9s %9s %9s\n",
+                   "class", "cpus", "size", "ways", "policy", "hit", "accesses", "hit rate", "latency", "CPI");
+            for (int k = -1; k < (int)core_classes.size(); k++)
+            {
+                long accesses = 0, hits = 0, entries = 0;
+                double busy = 0;
+                LatencyHistogram all;
+                string cpus;
+                Cache *first = NULL;
+
+                for (int i = 0; i < num_cpus; i++)
+                {
+                    if (cpu_class[i] != k) continue;
+                    Cache *c = cache[i];
+                    if (first == NULL) first = c;
+                    hits += c->read_hits + c->write_hits;
+                    accesses += c->read_hits + c->write_hits + c->read_misses + c->write_misses;
+                    entries += cpu[i]->instructions;
+                    busy += cpu[i]->finished / clk.period();
+                    for (int w = 0; w < 2; w++)
+                    {
+                        for (int a = 0; a < Protocol::NUM_ACTIONS; a++) all.merge(c->latency[w][a]);
+                    }
+                    char id[16];
+                    sprintf(id, "%s%d", cpus.empty() ? "" : ",", i);
+                    cpus += id;
+                }
+                // CPUs outside every class are listed as "default"
+                if (first == NULL) continue;
+
+                printf("    %-10s %-10s %9d %5d %-7s %4d %10ld %9f %9.2f %9f\n", k < 0 ? "default" : core_classes[k].name.c_str(),
+                       cpus.c_str(), first->size, first->ways, replacement_names[first->policy], first->hit_cycles, accesses,
+                       accesses ? (double)hits / accesses : 0.0, all.mean(), entries ? busy / entries : 0.0);
+            }
+        }
+
+        if (tracer_ptr != NULL) tracer_ptr->close();
         return 0;
     }
 
@@ -141,5 +1040,5 @@ int sc_main(int argc, char* argv[])
         cerr << e.what() << endl;
     }
 
-    return 0;
+    return 1;
 }
@@ -0,0 +1,304 @@
+/*
+// File: memctrl.h
+//
+// DRAM memory controller, replaces the fixed MEM_LATENCY when selected in
+// sc_main. Requests queue at the controller, which issues one per cycle to
+// its banks with either FCFS or FR-FCFS (oldest row hit first) scheduling.
+// Banks keep their row open after an access, so the latency of a request
+// depends on whether it hits the open row, finds the bank closed or has to
+// close another row first.
+//
+// Timing is given in the gpgpu_dram_timing_opt format of GPGPU-Sim, e.g.
+// the GDDR5 parameters from task_4/gpgpusim.config, in bus cycles. Keys
+// that are not modelled (RRD, RC, CDLR, nbkgrp, CCDL, RTPL) are accepted
+// and ignored, so a GPGPU-Sim string can be used as is.
+*/
+
+#ifndef MEMCTRL_H
+#define MEMCTRL_H
+
+#include <systemc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <list>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "../common/stats_export.h"
+#include "host_profiler.h"
+
+/* GDDR5 timing from task_4/gpgpusim.config. BL is the number of cycles a
+   line takes on the data pins (burst length 8 at a command/data ratio of 4). */
+#define DRAM_TIMING         "nbk=16:CCD=2:RRD=6:RCD=12:RAS=28:RP=12:RC=40:CL=12:WL=4:CDLR=5:WR=12:nbkgrp=4:CCDL=3:RTPL=2:BL=2"
+
+/* Bytes per row, consecutive rows go to consecutive banks. */
+#define DRAM_ROW_SIZE       2048
+
+/* Requests the scheduler can choose from (gpgpu_frfcfs_dram_sched_queue_size). */
+#define DRAM_QUEUE_SIZE     16
+
+class MemoryController : public ProfiledModule
+{
+public:
+    sc_in<bool> Port_CLK;
+
+    typedef struct {
+        int nbk;        // banks
+        int CCD;        // column to column
+        int RCD;        // activate to column
+        int RAS;        // activate to precharge
+        int RP;         // precharge to activate
+        int CL;         // read column to data
+        int WL;         // write column to data
+        int WR;         // write recovery before precharge
+        int BL;         // data cycles per line
+    } dram_timing_t;
+
+    /* Counters. */
+    long reads;
+    long writes;
+    long row_hits;
+    long row_misses;        // bank was closed
+    long row_conflicts;     // another row had to be closed first
+    long queue_waits;
+    long read_cycles;       // summed queueing and access time of reads
+
+    /* Parse a "key=value:key=value" timing string, throws on errors. */
+    static dram_timing_t parse_timing(const char *opt)
+    {
+        dram_timing_t t;
+        memset(&t, 0, sizeof(t));
+        t.nbk = 1;
+
+        std::string s(opt);
+        size_t pos = 0;
+        while (pos < s.size())
+        {
+            size_t end = s.find(':', pos);
+            if (end == std::string::npos) end = s.size();
+
+            std::string item = s.substr(pos, end - pos);
+            size_t eq = item.find('=');
+            if (eq == std::string::npos) throw std::invalid_argument("DRAM timing: expected key=value, got " + item);
+
+            std::string key = item.substr(0, eq);
+            // strip the whitespace a multi-line config value leaves behind
+            key.erase(0, key.find_first_not_of(" \t\n"));
+            int value = atoi(item.c_str() + eq + 1);
+
+            if (key == "nbk") t.nbk = value;
+            else if (key == "CCD") t.CCD = value;
+            else if (key == "RCD") t.RCD = value;
+            else if (key == "RAS") t.RAS = value;
+            else if (key == "RP") t.RP = value;
+            else if (key == "CL") t.CL = value;
+            else if (key == "WL") t.WL = value;
+            else if (key == "WR") t.WR = value;
+            else if (key == "BL") t.BL = value;
+            else if (key != "RRD" && key != "RC" && key != "CDLR" && key != "nbkgrp" && key != "CCDL" && key != "RTPL")
+            {
+                throw std::invalid_argument("DRAM timing: unknown parameter " + key);
+            }
+            pos = end + 1;
+        }
+
+        if (t.nbk <= 0 || t.BL <= 0) throw std::invalid_argument("DRAM timing: nbk and BL must be positive");
+        return t;
+    }
+
+    SC_HAS_PROCESS(MemoryController);
+
+    MemoryController(sc_module_name name, const dram_timing_t &timing, bool frfcfs, int queue_size)
+        : ProfiledModule(name), timing(timing), frfcfs(frfcfs), queue_size(queue_size), banks(timing.nbk), now(0)
+    {
+        SC_THREAD(schedule);
+        sensitive << Port_CLK.pos();
+        dont_initialize();
+
+        for (size_t i = 0; i < banks.size(); i++)
+        {
+            banks[i].open_row = -1;
+            banks[i].ready = 0;
+            banks[i].activated = 0;
+            banks[i].recovered = 0;
+        }
+
+        reads = 0;
+        writes = 0;
+        row_hits = 0;
+        row_misses = 0;
+        row_conflicts = 0;
+        queue_waits = 0;
+        read_cycles = 0;
+    }
+
+    /* Read or write the line at addr. Reads return once the data is back,
+       writes are posted and return as soon as they are queued. */
+    void access(uint64_t addr, bool write)
+    {
+        ProfileScope scope(PROF_DRAM);
+
+        while ((int)queue.size() >= queue_size)
+        {
+            queue_waits++;
+            wait();
+        }
+
+        request_t *req = new request_t;
+        req->write = write;
+        req->bank = (addr / DRAM_ROW_SIZE) % timing.nbk;
+        req->row = addr / DRAM_ROW_SIZE / timing.nbk;
+        req->arrival = now;
+        queue.push_back(req);
+
+        if (write)
+        {
+            writes++;
+            return;
+        }
+
+        reads++;
+        wait(req->done);
+        read_cycles += req->finish - req->arrival;
+        delete req;
+    }
+
+    void output()
+    {
+        long accesses = row_hits + row_misses + row_conflicts;
+
+        printf("\n 8. Memory controller (%d banks, %s)\n", timing.nbk, frfcfs ? "FR-FCFS" : "FCFS");
+        printf("    %ld reads and %ld writes.\n", reads, writes);
+        printf("    Row hits %ld, misses %ld, conflicts %ld; row hit rate %f%%.\n",
+               row_hits, row_misses, row_conflicts, accesses ? 100.0 * row_hits / accesses : 0.0);
+        printf("    Average read latency: %f cycles.\n", reads ? (double)read_cycles / reads : 0.0);
+        printf("    There were %ld waits for a full request queue.\n", queue_waits);
+    }
+
+    void watch(StatsExport &stats)
+    {
+        stats.counter("dram.reads", &reads);
+        stats.counter("dram.writes", &writes);
+        stats.counter("dram.row_hits", &row_hits);
+        stats.counter("dram.row_misses", &row_misses);
+        stats.counter("dram.row_conflicts", &row_conflicts);
+        stats.counter("dram.queue_waits", &queue_waits);
+        stats.counter("dram.read_cycles", &read_cycles);
+    }
+
+private:
+    typedef struct {
+        bool write;
+        int bank;
+        int64_t row;
+        long arrival;
+        long finish;
+        sc_event done;
+    } request_t;
+
+    typedef struct {
+        int64_t open_row;   // -1 when closed
+        long ready;         // next column or activate command
+        long activated;     // last activate
+        long recovered;     // end of write recovery
+    } bank_t;
+
+    dram_timing_t timing;
+    bool frfcfs;
+    int queue_size;
+
+    std::vector<bank_t> banks;
+    std::deque<request_t *> queue;
+    std::list<request_t *> inflight;
+    long now;
+
+    /* Every cycle retire finished requests and issue at most one more. */
+    void schedule()
+    {
+        ProfileScope scope(PROF_DRAM);
+
+        while (true)
+        {
+            wait();
+            now++;
+
+            for (std::list<request_t *>::iterator i = inflight.begin(); i != inflight.end(); )
+            {
+                request_t *req = *i;
+                if (req->finish > now)
+                {
+                    ++i;
+                    continue;
+                }
+                i = inflight.erase(i);
+                if (req->write) delete req;
+                else req->done.notify();
+            }
+
+            int pick = select();
+            if (pick < 0) continue;
+
+            request_t *req = queue[pick];
+            queue.erase(queue.begin() + pick);
+            issue(req);
+            inflight.push_back(req);
+        }
+    }
+
+    /* FCFS: the oldest request once its bank is ready. FR-FCFS: the oldest
+       row hit on a ready bank, else the oldest request on a ready bank. */
+    int select()
+    {
+        int pick = -1;
+
+        for (size_t i = 0; i < queue.size(); i++)
+        {
+            bank_t &b = banks[queue[i]->bank];
+
+            if (!frfcfs) return b.ready <= now ? 0 : -1;
+            if (b.ready > now) continue;
+            if (b.open_row == queue[i]->row) return i;
+            if (pick < 0) pick = i;
+        }
+        return pick;
+    }
+
+    /* Issue the commands for req and compute when its data is done. */
+    void issue(request_t *req)
+    {
+        bank_t &b = banks[req->bank];
+        long column;
+
+        if (b.open_row == req->row)
+        {
+            row_hits++;
+            column = now;
+        }
+        else
+        {
+            long activate = now;
+            if (b.open_row >= 0)
+            {
+                row_conflicts++;
+                long precharge = std::max(now, std::max(b.activated + timing.RAS, b.recovered));
+                activate = precharge + timing.RP;
+            }
+            else
+            {
+                row_misses++;
+            }
+            b.open_row = req->row;
+            b.activated = activate;
+            column = activate + timing.RCD;
+        }
+
+        req->finish = column + (req->write ? timing.WL : timing.CL) + timing.BL;
+        b.ready = column + timing.CCD;
+        if (req->write) b.recovered = req->finish + timing.WR;
+    }
+};
+
+#endif
@@ -0,0 +1,298 @@
+/*
+// File: protocol.h
+//
+// Table-driven coherence protocols. A protocol is written down as a list of
+// transitions (state x event -> next state, bus action, data supply) and
+// compiled into a dense lookup array, so handling an access or a snoop is a
+// single table lookup. The invalidation protocols MSI, MESI, MOESI and
+// MESIF and the update protocols Dragon and Firefly are provided and picked
+// by name at run time.
+*/
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include <string>
+
+class Protocol
+{
+public:
+    /* Line states, the union of the states of all protocols. */
+    enum State
+    {
+        I,      // invalid
+        S,      // shared
+        E,      // exclusive
+        O,      // owned
+        M,      // modified
+        F,      // forward
+        NUM_STATES
+    };
+
+    /* Processor accesses and snooped bus requests. */
+    enum Event
+    {
+        PR_RD,
+        PR_WR,
+        BUS_RD,
+        BUS_RDX,
+        BUS_UPGR,
+        BUS_UPD,    // a word written to a shared line, sent to the sharers
+        NUM_EVENTS
+    };
+
+    /* Bus transaction a processor event issues. */
+    enum Action
+    {
+        NONE,
+        ISSUE_RD,
+        ISSUE_RDX,
+        ISSUE_UPGR,
+        ISSUE_UPD,      // send the written word to the sharers
+        ISSUE_RD_UPD,   // read the line, then ISSUE_UPD if it is shared
+        NUM_ACTIONS
+    };
+
+    typedef struct {
+        uint8_t valid;          // the transition exists in this protocol
+        uint8_t next;           // next state
+        uint8_t next_shared;    // next state when another cache kept a copy (ISSUE_RD, ISSUE_UPD)
+        uint8_t action;         // bus transaction to issue
+        uint8_t supply;         // a snooping cache supplies the line
+    } transition_t;
+
+    /* One row of a protocol description. */
+    typedef struct {
+        State state;
+        Event event;
+        State next;
+        State next_shared;
+        Action action;
+        bool supply;
+    } rule_t;
+
+    const char *name;
+
+    /* Look up a protocol by name, throws for an unknown name. */
+    static const Protocol &get(const char *name);
+
+    const transition_t &lookup(int state, Event event) const
+    {
+        const transition_t &t = table[state][event];
+        if (!t.valid) {
+            throw std::logic_error(std::string(name) + ": no transition from " + state_name(state) + " on " + event_name(event));
+        }
+        return t;
+    }
+
+    /* Transition of a processor read or write to a line in state. */
+    const transition_t &access(int state, bool write) const
+    {
+        return lookup(state, write ? PR_WR : PR_RD);
+    }
+
+    /* Whether a line in state holds data memory does not have yet, so it
+       is written back when it leaves the cache. */
+    static bool dirty(int state)
+    {
+        return state == M || state == O;
+    }
+
+    static const char *state_name(int state)
+    {
+        static const char *names[NUM_STATES] = { "I", "S", "E", "O", "M", "F" };
+        return names[state];
+    }
+
+    static const char *event_name(int event)
+    {
+        static const char *names[NUM_EVENTS] = { "PrRd", "PrWr", "BusRd", "BusRdX", "BusUpgr", "BusUpd" };
+        return names[event];
+    }
+
+    static const char *action_name(int action)
+    {
+        static const char *names[NUM_ACTIONS] = { "none", "Rd", "RdX", "Upgr", "Upd", "Rd+Upd" };
+        return names[action];
+    }
+
+private:
+    transition_t table[NUM_STATES][NUM_EVENTS];
+
+    /* Compile rules into the dense table. Snooping a line that is not
+       present leaves it invalid in every protocol. */
+    Protocol(const char *name, const rule_t *rules, int n) : name(name)
+    {
+        memset(table, 0, sizeof(table));
+
+        for (int e = BUS_RD; e < NUM_EVENTS; e++) {
+            transition_t &t = table[I][e];
+            t.valid = 1;
+            t.next = t.next_shared = I;
+        }
+
+        for (int i = 0; i < n; i++) {
+            transition_t &t = table[rules[i].state][rules[i].event];
+            t.valid = 1;
+            t.next = rules[i].next;
+            t.next_shared = rules[i].next_shared;
+            t.action = rules[i].action;
+            t.supply = rules[i].supply;
+        }
+    }
+};
+
+/* Culler & Singh, MSI with BusUpgr. */
+static const Protocol::rule_t msi_rules[] = {
+    { Protocol::I, Protocol::PR_RD,    Protocol::S, Protocol::S, Protocol::ISSUE_RD,   false },
+    { Protocol::I, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::ISSUE_RDX,  false },
+    { Protocol::S, Protocol::PR_RD,    Protocol::S, Protocol::S, Protocol::NONE,       false },
+    { Protocol::S, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::ISSUE_UPGR, false },
+    { Protocol::S, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,       false },
+    { Protocol::S, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::S, Protocol::BUS_UPGR, Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::M, Protocol::PR_RD,    Protocol::M, Protocol::M, Protocol::NONE,       false },
+    { Protocol::M, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::NONE,       false },
+    { Protocol::M, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,       true  },
+    { Protocol::M, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       true  },
+};
+
+/* MSI plus an exclusive clean state for lines no other cache holds. */
+static const Protocol::rule_t mesi_rules[] = {
+    { Protocol::I, Protocol::PR_RD,    Protocol::E, Protocol::S, Protocol::ISSUE_RD,   false },
+    { Protocol::I, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::ISSUE_RDX,  false },
+    { Protocol::S, Protocol::PR_RD,    Protocol::S, Protocol::S, Protocol::NONE,       false },
+    { Protocol::S, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::ISSUE_UPGR, false },
+    { Protocol::S, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,       false },
+    { Protocol::S, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::S, Protocol::BUS_UPGR, Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::E, Protocol::PR_RD,    Protocol::E, Protocol::E, Protocol::NONE,       false },
+    { Protocol::E, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::NONE,       false },
+    { Protocol::E, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,       false },
+    { Protocol::E, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::M, Protocol::PR_RD,    Protocol::M, Protocol::M, Protocol::NONE,       false },
+    { Protocol::M, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::NONE,       false },
+    { Protocol::M, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,       true  },
+    { Protocol::M, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       true  },
+};
+
+/* MESI plus an owned state, so a dirty line can be shared without writing
+   it back; the owner supplies it to readers. */
+static const Protocol::rule_t moesi_rules[] = {
+    { Protocol::I, Protocol::PR_RD,    Protocol::E, Protocol::S, Protocol::ISSUE_RD,   false },
+    { Protocol::I, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::ISSUE_RDX,  false },
+    { Protocol::S, Protocol::PR_RD,    Protocol::S, Protocol::S, Protocol::NONE,       false },
+    { Protocol::S, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::ISSUE_UPGR, false },
+    { Protocol::S, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,       false },
+    { Protocol::S, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::S, Protocol::BUS_UPGR, Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::E, Protocol::PR_RD,    Protocol::E, Protocol::E, Protocol::NONE,       false },
+    { Protocol::E, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::NONE,       false },
+    { Protocol::E, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,       false },
+    { Protocol::E, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::O, Protocol::PR_RD,    Protocol::O, Protocol::O, Protocol::NONE,       false },
+    { Protocol::O, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::ISSUE_UPGR, false },
+    { Protocol::O, Protocol::BUS_RD,   Protocol::O, Protocol::O, Protocol::NONE,       true  },
+    { Protocol::O, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       true  },
+    { Protocol::O, Protocol::BUS_UPGR, Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::M, Protocol::PR_RD,    Protocol::M, Protocol::M, Protocol::NONE,       false },
+    { Protocol::M, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::NONE,       false },
+    { Protocol::M, Protocol::BUS_RD,   Protocol::O, Protocol::O, Protocol::NONE,       true  },
+    { Protocol::M, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       true  },
+};
+
+/* MESI plus a forward state: of the clean sharers exactly one, the most
+   recent reader, supplies the line to the next reader. */
+static const Protocol::rule_t mesif_rules[] = {
+    { Protocol::I, Protocol::PR_RD,    Protocol::E, Protocol::F, Protocol::ISSUE_RD,   false },
+    { Protocol::I, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::ISSUE_RDX,  false },
+    { Protocol::S, Protocol::PR_RD,    Protocol::S, Protocol::S, Protocol::NONE,       false },
+    { Protocol::S, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::ISSUE_UPGR, false },
+    { Protocol::S, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,       false },
+    { Protocol::S, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::S, Protocol::BUS_UPGR, Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::F, Protocol::PR_RD,    Protocol::F, Protocol::F, Protocol::NONE,       false },
+    { Protocol::F, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::ISSUE_UPGR, false },
+    { Protocol::F, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,       true  },
+    { Protocol::F, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       true  },
+    { Protocol::F, Protocol::BUS_UPGR, Protocol::I, Protocol::I, Protocol::NONE,       false },
+    { Protocol::E, Protocol::PR_RD,    Protocol::E, Protocol::E, Protocol::NONE,       false },
+    { Protocol::E, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::NONE,       false },
+    { Protocol::E, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,       true  },
+    { Protocol::E, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       true  },
+    { Protocol::M, Protocol::PR_RD,    Protocol::M, Protocol::M, Protocol::NONE,       false },
+    { Protocol::M, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::NONE,       false },
+    { Protocol::M, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,       true  },
+    { Protocol::M, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,       true  },
+};
+
+/* Dragon update protocol. S is shared-clean and O shared-modified; writes
+   to a shared line update the other copies instead of invalidating them,
+   and the last writer owns the line. BusRdX only occurs as a
+   back-invalidation. */
+static const Protocol::rule_t dragon_rules[] = {
+    { Protocol::I, Protocol::PR_RD,    Protocol::E, Protocol::S, Protocol::ISSUE_RD,     false },
+    { Protocol::I, Protocol::PR_WR,    Protocol::M, Protocol::O, Protocol::ISSUE_RD_UPD, false },
+    { Protocol::E, Protocol::PR_RD,    Protocol::E, Protocol::E, Protocol::NONE,         false },
+    { Protocol::E, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::NONE,         false },
+    { Protocol::E, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,         false },
+    { Protocol::E, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,         false },
+    { Protocol::S, Protocol::PR_RD,    Protocol::S, Protocol::S, Protocol::NONE,         false },
+    { Protocol::S, Protocol::PR_WR,    Protocol::M, Protocol::O, Protocol::ISSUE_UPD,    false },
+    { Protocol::S, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,         false },
+    { Protocol::S, Protocol::BUS_UPD,  Protocol::S, Protocol::S, Protocol::NONE,         false },
+    { Protocol::S, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,         false },
+    { Protocol::O, Protocol::PR_RD,    Protocol::O, Protocol::O, Protocol::NONE,         false },
+    { Protocol::O, Protocol::PR_WR,    Protocol::M, Protocol::O, Protocol::ISSUE_UPD,    false },
+    { Protocol::O, Protocol::BUS_RD,   Protocol::O, Protocol::O, Protocol::NONE,         true  },
+    { Protocol::O, Protocol::BUS_UPD,  Protocol::S, Protocol::S, Protocol::NONE,         false },
+    { Protocol::O, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,         true  },
+    { Protocol::M, Protocol::PR_RD,    Protocol::M, Protocol::M, Protocol::NONE,         false },
+    { Protocol::M, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::NONE,         false },
+    { Protocol::M, Protocol::BUS_RD,   Protocol::O, Protocol::O, Protocol::NONE,         true  },
+    { Protocol::M, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,         true  },
+};
+
+/* Firefly update protocol. Writes to a shared line go through to memory
+   as well as to the other copies, so shared lines are always clean and
+   only an unshared line can become dirty. Caches supply lines to readers. */
+static const Protocol::rule_t firefly_rules[] = {
+    { Protocol::I, Protocol::PR_RD,    Protocol::E, Protocol::S, Protocol::ISSUE_RD,     false },
+    { Protocol::I, Protocol::PR_WR,    Protocol::M, Protocol::S, Protocol::ISSUE_RD_UPD, false },
+    { Protocol::E, Protocol::PR_RD,    Protocol::E, Protocol::E, Protocol::NONE,         false },
+    { Protocol::E, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::NONE,         false },
+    { Protocol::E, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,         true  },
+    { Protocol::E, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,         false },
+    { Protocol::S, Protocol::PR_RD,    Protocol::S, Protocol::S, Protocol::NONE,         false },
+    { Protocol::S, Protocol::PR_WR,    Protocol::E, Protocol::S, Protocol::ISSUE_UPD,    false },
+    { Protocol::S, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,         true  },
+    { Protocol::S, Protocol::BUS_UPD,  Protocol::S, Protocol::S, Protocol::NONE,         false },
+    { Protocol::S, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,         false },
+    { Protocol::M, Protocol::PR_RD,    Protocol::M, Protocol::M, Protocol::NONE,         false },
+    { Protocol::M, Protocol::PR_WR,    Protocol::M, Protocol::M, Protocol::NONE,         false },
+    { Protocol::M, Protocol::BUS_RD,   Protocol::S, Protocol::S, Protocol::NONE,         true  },
+    { Protocol::M, Protocol::BUS_RDX,  Protocol::I, Protocol::I, Protocol::NONE,         true  },
+};
+
+#define PROTOCOL_RULES(r) r, (int)(sizeof(r) / sizeof(r[0]))
+
+inline const Protocol &Protocol::get(const char *name)
+{
+    static const Protocol msi("msi", PROTOCOL_RULES(msi_rules));
+    static const Protocol mesi("mesi", PROTOCOL_RULES(mesi_rules));
+    static const Protocol moesi("moesi", PROTOCOL_RULES(moesi_rules));
+    static const Protocol mesif("mesif", PROTOCOL_RULES(mesif_rules));
+    static const Protocol dragon("dragon", PROTOCOL_RULES(dragon_rules));
+    static const Protocol firefly("firefly", PROTOCOL_RULES(firefly_rules));
+    static const Protocol *all[] = { &msi, &mesi, &moesi, &mesif, &dragon, &firefly };
+
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        if (strcmp(all[i]->name, name) == 0) return *all[i];
+    }
+    throw std::invalid_argument(std::string("Unknown coherence protocol ") + name);
+}
+
+#endif
@@ -0,0 +1,368 @@
+/*
+// File: session.h
+//
+// Functional cache/coherence model for parameter sweeps, without SystemC
+// and without global state. A trace is loaded once into a LoadedTrace and
+// shared read-only; every Session owns its caches and counters, so any
+// number of sessions with different configurations can run at the same
+// time on different threads (see SweepPool and tools/sweep.cpp).
+//
+// The caches and protocols behave as in the SystemC model: every access
+// and every snoop is a lookup in the Protocol tables of protocol.h, with
+// LRU replacement and write-back of dirty victims, on an atomic snooping
+// bus. Time is estimated, not simulated: a hit costs
+// the hit latency, a miss the cache-to-cache or the memory latency, and
+// there is no contention. The CPU that is furthest behind in time issues
+// the next access. Atomics are treated as writes and load-linked as a
+// read; a store-conditional always succeeds.
+*/
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "protocol.h"
+#include "stream_trace.h"
+#include <stdint.h>
+#include <pthread.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+/* Trace entries of every CPU, read once and never changed. */
+class LoadedTrace
+{
+public:
+    /* Read a trace in the stream format of stream_trace.h, "-" for stdin. */
+    LoadedTrace(const char *path, int cpus) : lists(cpus), total(0)
+    {
+        StreamTrace stream(path, cpus);
+        trace_entry_t entry;
+        bool more = true;
+
+        // a CPU whose queue is drained may stall on another CPU's full queue
+        while (more)
+        {
+            more = false;
+            for (int c = 0; c < cpus; c++)
+            {
+                TraceStatus status;
+                while ((status = stream.next(c, entry)) == TRACE_ENTRY) lists[c].push_back(entry);
+                if (status != TRACE_END) more = true;
+            }
+        }
+        for (int c = 0; c < cpus; c++) total += lists[c].size();
+    }
+
+    int cpus() const { return lists.size(); }
+    long size() const { return total; }
+
+    const std::vector<trace_entry_t> &entries(int cpu) const
+    {
+        return lists[cpu];
+    }
+
+private:
+    std::vector< std::vector<trace_entry_t> > lists;
+    long total;
+};
+
+/* Parameters of one session, the defaults are those of task_3. */
+struct SessionConfig
+{
+    std::string protocol;
+    int cache_size;
+    int associativity;
+    int line_size;
+    int hit_latency;
+    int mem_latency;
+    int c2c_latency;
+
+    SessionConfig() : protocol("moesi"), cache_size(32768), associativity(8), line_size(32),
+                      hit_latency(1), mem_latency(100), c2c_latency(20) {}
+};
+
+typedef struct {
+    long read_hits;
+    long read_misses;
+    long write_hits;
+    long write_misses;
+    long cycles;            // estimated, see above
+} session_cpu_stats_t;
+
+struct SessionStats
+{
+    std::vector<session_cpu_stats_t> cpu;
+    long reads;             // bus transactions
+    long readxs;
+    long upgrades;
+    long updates;
+    long transfers;         // lines supplied by another cache
+    long memory_reads;
+    long writebacks;
+
+    SessionStats() : reads(0), readxs(0), upgrades(0), updates(0), transfers(0), memory_reads(0), writebacks(0) {}
+
+    long hits() const
+    {
+        long n = 0;
+        for (size_t i = 0; i < cpu.size(); i++) n += cpu[i].read_hits + cpu[i].write_hits;
+        return n;
+    }
+
+    long misses() const
+    {
+        long n = 0;
+        for (size_t i = 0; i < cpu.size(); i++) n += cpu[i].read_misses + cpu[i].write_misses;
+        return n;
+    }
+
+    /* Cycles of the CPU that finished last. */
+    long cycles() const
+    {
+        long n = 0;
+        for (size_t i = 0; i < cpu.size(); i++) n = std::max(n, cpu[i].cycles);
+        return n;
+    }
+};
+
+class Session
+{
+public:
+    /* Throws for an unknown protocol or a geometry that cannot be built. */
+    Session(const LoadedTrace &trace, const SessionConfig &config)
+        : trace(trace), config(config), protocol(Protocol::get(config.protocol.c_str()))
+    {
+        num_sets = config.associativity > 0 && config.line_size > 0 ? config.cache_size / config.line_size / config.associativity : 0;
+        if (num_sets <= 0 || num_sets * config.line_size * config.associativity != config.cache_size ||
+            (num_sets & (num_sets - 1)) || (config.line_size & (config.line_size - 1)))
+        {
+            throw std::invalid_argument("The line size and the number of sets must be powers of two");
+        }
+
+        caches.assign(trace.cpus(), std::vector<line_t>(num_sets * config.associativity));
+        stats.cpu.assign(trace.cpus(), session_cpu_stats_t());
+        clock = 0;
+    }
+
+    /* Run the whole trace. */
+    const SessionStats &run()
+    {
+        std::vector<size_t> next(trace.cpus(), 0);
+
+        while (true)
+        {
+            int c = -1;
+            for (int i = 0; i < trace.cpus(); i++)
+            {
+                if (next[i] == trace.entries(i).size()) continue;
+                if (c < 0 || stats.cpu[i].cycles < stats.cpu[c].cycles) c = i;
+            }
+            if (c < 0) break;
+
+            const trace_entry_t &e = trace.entries(c)[next[c]++];
+            switch (e.type)
+            {
+                case trace_entry_t::READ:
+                case trace_entry_t::LL:
+                    access(c, e.addr, false);
+                    break;
+                case trace_entry_t::WRITE:
+                case trace_entry_t::RMW:
+                case trace_entry_t::SC:
+                    access(c, e.addr, true);
+                    break;
+                case trace_entry_t::NOP:
+                    stats.cpu[c].cycles++;
+                    break;
+                default:
+                    // a fence has nothing to wait for, accesses complete in order
+                    break;
+            }
+        }
+        return stats;
+    }
+
+    const SessionStats &result() const
+    {
+        return stats;
+    }
+
+private:
+    typedef struct {
+        uint64_t tag;
+        uint64_t used;          // clock of the last access, for LRU
+        uint8_t state;
+    } line_t;
+
+    const LoadedTrace &trace;
+    SessionConfig config;
+    const Protocol &protocol;
+    int num_sets;
+    std::vector< std::vector<line_t> > caches;
+    uint64_t clock;
+    SessionStats stats;
+
+    /* Line of addr in cache c, NULL when not present. */
+    line_t *find(int c, uint64_t line)
+    {
+        line_t *set = &caches[c][(line & (num_sets - 1)) * config.associativity];
+        uint64_t tag = line / num_sets;
+
+        for (int i = 0; i < config.associativity; i++)
+        {
+            if (set[i].state != Protocol::I && set[i].tag == tag) return &set[i];
+        }
+        return NULL;
+    }
+
+    /* Present event to every other cache. Returns true when a copy is left
+       somewhere, supplied is set when a cache supplies the line. */
+    bool snoop(int writer, uint64_t line, Protocol::Event event, bool &supplied)
+    {
+        bool copies = false;
+
+        for (int c = 0; c < (int)caches.size(); c++)
+        {
+            line_t *l = c == writer ? NULL : find(c, line);
+            if (l == NULL) continue;
+
+            const Protocol::transition_t &t = protocol.lookup(l->state, event);
+            if (t.supply) supplied = true;
+            l->state = t.next;
+            if (l->state != Protocol::I) copies = true;
+        }
+        return copies;
+    }
+
+    /* Fetch line into cache c with Rd or RdX, into the LRU line of its set
+       unless it is present. Returns the line used. */
+    line_t *fetch(int c, uint64_t line, line_t *present, Protocol::Event event, bool &copies)
+    {
+        bool supplied = false;
+        copies = snoop(c, line, event, supplied);
+        if (supplied) stats.transfers++;
+        else stats.memory_reads++;
+        stats.cpu[c].cycles += supplied ? config.c2c_latency : config.mem_latency;
+        if (present != NULL) return present;
+
+        line_t *set = &caches[c][(line & (num_sets - 1)) * config.associativity];
+        line_t *victim = &set[0];
+        for (int i = 0; i < config.associativity; i++)
+        {
+            if (set[i].state == Protocol::I) { victim = &set[i]; break; }
+            if (set[i].used < victim->used) victim = &set[i];
+        }
+        if (Protocol::dirty(victim->state)) stats.writebacks++;
+
+        victim->tag = line / num_sets;
+        return victim;
+    }
+
+    void access(int c, uint64_t addr, bool write)
+    {
+        uint64_t line = addr / config.line_size;
+        line_t *l = find(c, line);
+        int state = l != NULL ? l->state : (int)Protocol::I;
+        bool hit = l != NULL;
+        bool copies = false;
+
+        session_cpu_stats_t &s = stats.cpu[c];
+        if (write) (hit ? s.write_hits : s.write_misses)++;
+        else (hit ? s.read_hits : s.read_misses)++;
+        if (hit) s.cycles += config.hit_latency;
+
+        const Protocol::transition_t &t = protocol.access(state, write);
+        int next = t.next;
+        bool unused;
+
+        switch (t.action)
+        {
+            case Protocol::ISSUE_UPGR:
+                stats.upgrades++;
+                snoop(c, line, Protocol::BUS_UPGR, unused);
+                break;
+
+            case Protocol::ISSUE_RD:
+            case Protocol::ISSUE_RD_UPD:
+                stats.reads++;
+                l = fetch(c, line, l, Protocol::BUS_RD, copies);
+                if (copies) next = t.next_shared;
+                if (copies && t.action == Protocol::ISSUE_RD_UPD)
+                {
+                    stats.updates++;
+                    snoop(c, line, Protocol::BUS_UPD, unused);
+                }
+                break;
+
+            case Protocol::ISSUE_UPD:
+                stats.updates++;
+                if (snoop(c, line, Protocol::BUS_UPD, unused)) next = t.next_shared;
+                break;
+
+            case Protocol::ISSUE_RDX:
+                stats.readxs++;
+                l = fetch(c, line, l, Protocol::BUS_RDX, copies);
+                break;
+
+            default:
+                break;
+        }
+
+        l->state = next;
+        l->used = ++clock;
+    }
+};
+
+/* Runs sessions for a list of configurations over one trace on a pool of
+   threads. A configuration that cannot be built leaves its error in
+   errors and empty stats. */
+class SweepPool
+{
+public:
+    SweepPool(const LoadedTrace &trace, const std::vector<SessionConfig> &configs)
+        : trace(trace), configs(configs), results(configs.size()), errors(configs.size()), next(0) {}
+
+    void run(int threads)
+    {
+        std::vector<pthread_t> pool(threads);
+        int started = 0;
+        while (started < threads && pthread_create(&pool[started], NULL, worker, this) == 0) started++;
+
+        // the threads that did start still run to the end of the list
+        for (int i = 0; i < started; i++) pthread_join(pool[i], NULL);
+        if (started < threads) throw std::runtime_error("cannot start a sweep thread");
+    }
+
+    const SessionStats &result(size_t i) const { return results[i]; }
+    const std::string &error(size_t i) const { return errors[i]; }
+
+private:
+    const LoadedTrace &trace;
+    const std::vector<SessionConfig> &configs;
+    std::vector<SessionStats> results;
+    std::vector<std::string> errors;
+    size_t next;            // next configuration to run, taken atomically
+
+    static void *worker(void *arg)
+    {
+        SweepPool *pool = (SweepPool *)arg;
+        size_t i;
+
+        while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->configs.size())
+        {
+            try
+            {
+                Session session(pool->trace, pool->configs[i]);
+                pool->results[i] = session.run();
+            }
+            catch (std::exception &e)
+            {
+                pool->errors[i] = e.what();
+            }
+        }
+        return NULL;
+    }
+};
+
+#endif
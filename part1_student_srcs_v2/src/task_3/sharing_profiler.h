@@ -0,0 +1,167 @@
+/*
+// File: sharing_profiler.h
+//
+// Per-line coherence instrumentation. Every access records the bytes each
+// CPU touches in a line. When a write invalidates or updates another
+// cache's copy, the bytes that cache used since it got the line are
+// compared with the bytes written: if they are disjoint the coherence
+// traffic was caused by false sharing. The report ranks the lines with the
+// most coherence traffic and shows which bytes each CPU used.
+*/
+
+#ifndef SHARING_PROFILER_H
+#define SHARING_PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+class SharingProfiler
+{
+public:
+    /* Byte masks of one CPU in one line. */
+    typedef struct {
+        std::vector<uint64_t> used;     // since the CPU last lost its copy
+        std::vector<uint64_t> stored;   // written since then
+        std::vector<uint64_t> read;     // whole run
+        std::vector<uint64_t> written;  // whole run
+    } masks_t;
+
+    /* Coherence counters of one line. */
+    typedef struct {
+        long invalidations;
+        long false_invalidations;
+        long updates;
+        long false_updates;
+        std::map<int, masks_t> cpus;
+    } line_t;
+
+    SharingProfiler(int line_size) : line_size(line_size), words((line_size + 63) / 64) {}
+
+    /* cpu read or wrote the byte at addr. */
+    void access(int cpu, uint64_t addr, bool write)
+    {
+        masks_t &m = masks(lines[addr / line_size], cpu);
+        int offset = addr % line_size;
+
+        set(m.used, offset);
+        if (write) set(m.stored, offset);
+        set(write ? m.written : m.read, offset);
+    }
+
+    /* A write by writer to the byte at addr invalidated the copy of cpu. */
+    void invalidated(int cpu, int writer, uint64_t addr)
+    {
+        line_t &l = lines[addr / line_size];
+
+        l.invalidations++;
+        if (disjoint(l, cpu, writer, addr % line_size)) l.false_invalidations++;
+
+        // The next copy starts with a clean slate
+        masks_t &m = masks(l, cpu);
+        m.used.assign(words, 0);
+        m.stored.assign(words, 0);
+    }
+
+    /* A write by writer to the byte at addr updated the copy of cpu. */
+    void updated(int cpu, int writer, uint64_t addr)
+    {
+        line_t &l = lines[addr / line_size];
+
+        l.updates++;
+        if (disjoint(l, cpu, writer, addr % line_size)) l.false_updates++;
+    }
+
+    /* Print the top lines by coherence traffic. */
+    void output(int top)
+    {
+        std::vector< std::pair<long, uint64_t> > ranked;
+        long invalidations = 0, false_invalidations = 0, updates = 0, false_updates = 0;
+
+        for (std::map<uint64_t, line_t>::iterator i = lines.begin(); i != lines.end(); ++i)
+        {
+            line_t &l = i->second;
+            invalidations += l.invalidations;
+            false_invalidations += l.false_invalidations;
+            updates += l.updates;
+            false_updates += l.false_updates;
+            if (l.invalidations + l.updates > 0) ranked.push_back(std::make_pair(l.invalidations + l.updates, i->first));
+        }
+        std::sort(ranked.rbegin(), ranked.rend());
+
+        printf("    %ld invalidations, %ld of them false sharing.\n", invalidations, false_invalidations);
+        printf("    %ld updates, %ld of them to bytes the receiver never used.\n", updates, false_updates);
+        printf("    %d of %d contended lines (r: read, w: written, b: both):\n",
+               std::min(top, (int)ranked.size()), (int)ranked.size());
+
+        for (int i = 0; i < top && i < (int)ranked.size(); i++)
+        {
+            line_t &l = lines[ranked[i].second];
+            long coherence = l.invalidations + l.updates;
+            long false_sharing = l.false_invalidations + l.false_updates;
+
+            printf("    0x%010llx  inval %8ld (false %8ld)  upd %8ld (false %8ld)%s\n",
+                   (unsigned long long)(ranked[i].second * line_size),
+                   l.invalidations, l.false_invalidations, l.updates, l.false_updates,
+                   2 * false_sharing > coherence ? "  FALSE SHARING" : "");
+
+            for (std::map<int, masks_t>::iterator c = l.cpus.begin(); c != l.cpus.end(); ++c)
+            {
+                printf("        cpu %3d  ", c->first);
+                for (int b = 0; b < line_size; b++)
+                {
+                    bool r = test(c->second.read, b), w = test(c->second.written, b);
+                    putchar(r && w ? 'b' : w ? 'w' : r ? 'r' : '.');
+                }
+                putchar('\n');
+            }
+        }
+    }
+
+private:
+    int line_size;
+    int words;
+    std::map<uint64_t, line_t> lines;
+
+    masks_t &masks(line_t &l, int cpu)
+    {
+        masks_t &m = l.cpus[cpu];
+        if (m.used.empty())
+        {
+            m.used.assign(words, 0);
+            m.stored.assign(words, 0);
+            m.read.assign(words, 0);
+            m.written.assign(words, 0);
+        }
+        return m;
+    }
+
+    /* True when none of the bytes cpu used were written by writer while it
+       held its current copy. */
+    bool disjoint(line_t &l, int cpu, int writer, int offset)
+    {
+        masks_t &victim = masks(l, cpu);
+        masks_t &w = masks(l, writer);
+
+        if (test(victim.used, offset)) return false;
+        for (int i = 0; i < words; i++)
+        {
+            if (victim.used[i] & w.stored[i]) return false;
+        }
+        return true;
+    }
+
+    static void set(std::vector<uint64_t> &mask, int byte)
+    {
+        mask[byte / 64] |= (uint64_t)1 << (byte % 64);
+    }
+
+    static bool test(const std::vector<uint64_t> &mask, int byte)
+    {
+        return (mask[byte / 64] >> (byte % 64)) & 1;
+    }
+};
+
+#endif
@@ -0,0 +1,139 @@
+/*
+// File: snoop_filter.h
+//
+// Inclusive snoop filter for the Bus. For every line that may be cached it
+// keeps one presence bit per cache, so a request is only presented to the
+// caches that may hold the line. The filter is set-associative with LRU
+// replacement; evicting an entry back-invalidates the line in every cache
+// that may hold it, which keeps the filter inclusive.
+*/
+
+#ifndef SNOOP_FILTER_H
+#define SNOOP_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* Associativity of the snoop filter. */
+#define SF_WAYS             8
+
+class SnoopFilter
+{
+public:
+    /* Filter entry: the presence bits of one line. */
+    typedef struct {
+        bool valid;
+        uint64_t line;
+        uint64_t used;
+        std::vector<uint64_t> present;
+    } entry_t;
+
+    /* Counters. */
+    long probes;            // snoops delivered
+    long filtered;          // snoops skipped because the cache cannot hold the line
+    long evictions;         // entries replaced
+    long back_invalidations;
+
+    /* Filter with room for entries lines of cpus caches. */
+    SnoopFilter(int cpus, int entries)
+        : words((cpus + 63) / 64), sets(entries / SF_WAYS > 0 ? entries / SF_WAYS : 1),
+          table(sets * SF_WAYS), clock(0)
+    {
+        for (size_t i = 0; i < table.size(); i++)
+        {
+            table[i].valid = false;
+            table[i].present.assign(words, 0);
+        }
+
+        probes = 0;
+        filtered = 0;
+        evictions = 0;
+        back_invalidations = 0;
+    }
+
+    /* Entry of line, NULL when no cache can hold it. */
+    entry_t *find(uint64_t line)
+    {
+        entry_t *set = &table[(line % sets) * SF_WAYS];
+
+        for (int i = 0; i < SF_WAYS; i++)
+        {
+            if (set[i].valid && set[i].line == line)
+            {
+                set[i].used = ++clock;
+                return &set[i];
+            }
+        }
+        return NULL;
+    }
+
+    /* Entry for line, replacing the least recently used entry of its set
+       when needed. A replaced entry is copied to victim and victim.valid is
+       set, so the caller can back-invalidate it. */
+    entry_t *insert(uint64_t line, entry_t &victim)
+    {
+        entry_t *e = find(line);
+        victim.valid = false;
+        if (e != NULL) return e;
+
+        entry_t *set = &table[(line % sets) * SF_WAYS];
+        e = &set[0];
+        for (int i = 0; i < SF_WAYS; i++)
+        {
+            if (!set[i].valid)
+            {
+                e = &set[i];
+                break;
+            }
+            if (set[i].used < e->used) e = &set[i];
+        }
+
+        if (e->valid)
+        {
+            evictions++;
+            victim = *e;
+        }
+
+        e->valid = true;
+        e->line = line;
+        e->used = ++clock;
+        e->present.assign(words, 0);
+        return e;
+    }
+
+    static bool present(const entry_t &e, int cache)
+    {
+        return (e.present[cache / 64] >> (cache % 64)) & 1;
+    }
+
+    static void set(entry_t &e, int cache)
+    {
+        e.present[cache / 64] |= (uint64_t)1 << (cache % 64);
+    }
+
+    static void clear(entry_t &e, int cache)
+    {
+        e.present[cache / 64] &= ~((uint64_t)1 << (cache % 64));
+    }
+
+    /* Next cache at or after from that may hold the line, -1 if none. */
+    static int next(const entry_t &e, int from)
+    {
+        for (size_t w = from / 64; w < e.present.size(); w++)
+        {
+            uint64_t bits = e.present[w];
+            if (w == (size_t)from / 64) bits &= ~(uint64_t)0 << (from % 64);
+            if (bits) return w * 64 + __builtin_ctzll(bits);
+        }
+        return -1;
+    }
+
+private:
+    int words;
+    int sets;
+    std::vector<entry_t> table;
+    uint64_t clock;
+};
+
+#endif
@@ -0,0 +1,215 @@
+/*
+// File: stream_trace.h
+//
+// Incremental trace reader for live address-trace producers. The trace is
+// pulled from a pipe, FIFO, regular file or stdin in fixed-size chunks and
+// split into bounded per-CPU queues, so memory use stays constant no matter
+// how long the producer keeps writing.
+//
+// Stream format, one access per line ('#' starts a comment):
+//
+//     <cpu> <r|w|a|l|c|f|n> <addr>
+//
+// for read, write, atomic read-modify-write, load-linked, store-conditional,
+// fence and NOP, where <addr> is decimal or 0x-prefixed hexadecimal and may
+// be omitted for a fence or a NOP.
+*/
+
+#ifndef STREAM_TRACE_H
+#define STREAM_TRACE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <deque>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+
+#define STREAM_CHUNK_SIZE   65536   // bytes pulled from the source per read()
+#define STREAM_QUEUE_DEPTH  1024    // decoded entries buffered per CPU
+
+/* Trace entry as seen by the CPU, independent of the trace source. */
+typedef struct {
+    enum Type {
+        READ,
+        WRITE,
+        NOP,
+        RMW,
+        LL,
+        SC,
+        FENCE,
+    } type;
+    uint64_t addr;
+} trace_entry_t;
+
+/* Result of asking a trace source for the next entry of a CPU. */
+enum TraceStatus
+{
+    TRACE_ENTRY,    // an entry was returned
+    TRACE_STALL,    // nothing yet, another CPU's queue is full; retry later
+    TRACE_END,      // the source is exhausted for this CPU
+};
+
+class StreamTrace
+{
+public:
+    /* Open path for reading; "-" selects stdin. */
+    StreamTrace(const char *path, int cpus)
+        : queues(cpus), len(0), pos(0), line_no(0), at_eof(false)
+    {
+        if (strcmp(path, "-") == 0) {
+            fd = STDIN_FILENO;
+        }
+        else {
+            // Opening a FIFO blocks until the producer connects.
+            fd = open(path, O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error(std::string("Cannot open trace stream ") + path + ": " + strerror(errno));
+            }
+        }
+    }
+
+    ~StreamTrace()
+    {
+        if (fd != STDIN_FILENO) close(fd);
+    }
+
+    /* Get the next entry for cpu. Reads more of the stream only while none
+       of the per-CPU queues is full, which pushes back on the producer
+       through the pipe once the simulation falls behind. */
+    TraceStatus next(int cpu, trace_entry_t &entry)
+    {
+        std::deque<trace_entry_t> &q = queues[cpu];
+
+        while (q.empty()) {
+            if (at_eof) return TRACE_END;
+            if (queue_full()) return TRACE_STALL;
+            parse_line();
+        }
+
+        entry = q.front();
+        q.pop_front();
+        return TRACE_ENTRY;
+    }
+
+private:
+    int fd;
+    std::vector< std::deque<trace_entry_t> > queues;
+
+    char buf[STREAM_CHUNK_SIZE];
+    size_t len;         // valid bytes in buf
+    size_t pos;         // start of the first unparsed line
+    long line_no;
+    bool at_eof;
+
+    bool queue_full() const
+    {
+        for (size_t i = 0; i < queues.size(); i++) {
+            if (queues[i].size() >= STREAM_QUEUE_DEPTH) return true;
+        }
+        return false;
+    }
+
+    /* Move the partial line to the front and top up the buffer. Returns
+       false when the producer closed its end of the stream. */
+    bool fill()
+    {
+        memmove(buf, buf + pos, len - pos);
+        len -= pos;
+        pos = 0;
+
+        if (len == sizeof(buf)) {
+            throw std::runtime_error(error("line too long"));
+        }
+
+        ssize_t n;
+        do {
+            n = read(fd, buf + len, sizeof(buf) - len);
+        } while (n < 0 && errno == EINTR);
+
+        if (n < 0) {
+            throw std::runtime_error(std::string("Error reading trace stream: ") + strerror(errno));
+        }
+        len += n;
+        return n > 0;
+    }
+
+    /* Decode one line into its CPU queue, reading more input when needed. */
+    void parse_line()
+    {
+        char *nl = (char *)memchr(buf + pos, '\n', len - pos);
+        while (nl == NULL) {
+            if (!fill()) {
+                at_eof = true;
+                if (pos == len) return;
+                // Last line without a trailing newline.
+                buf[len] = '\0';
+                decode(buf + pos);
+                pos = len;
+                return;
+            }
+            nl = (char *)memchr(buf + pos, '\n', len - pos);
+        }
+
+        *nl = '\0';
+        decode(buf + pos);
+        pos = nl - buf + 1;
+    }
+
+    void decode(char *line)
+    {
+        line_no++;
+
+        char *hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+
+        char *end;
+        long cpu = strtol(line, &end, 10);
+        if (end == line) {
+            // Blank or comment-only line
+            while (*end == ' ' || *end == '\t' || *end == '\r') end++;
+            if (*end == '\0') return;
+            throw std::runtime_error(error("missing CPU number"));
+        }
+        if (cpu < 0 || cpu >= (long)queues.size()) {
+            throw std::runtime_error(error("CPU number out of range"));
+        }
+
+        while (*end == ' ' || *end == '\t') end++;
+
+        trace_entry_t entry;
+        switch (*end) {
+            case 'r': case 'R': entry.type = trace_entry_t::READ;  break;
+            case 'w': case 'W': entry.type = trace_entry_t::WRITE; break;
+            case 'n': case 'N': entry.type = trace_entry_t::NOP;   break;
+            case 'a': case 'A': entry.type = trace_entry_t::RMW;   break;
+            case 'l': case 'L': entry.type = trace_entry_t::LL;    break;
+            case 'c': case 'C': entry.type = trace_entry_t::SC;    break;
+            case 'f': case 'F': entry.type = trace_entry_t::FENCE; break;
+            default:
+                throw std::runtime_error(error("unknown access type"));
+        }
+
+        char *addr = end + 1;
+        entry.addr = strtoull(addr, &end, 0);
+        if (end == addr && entry.type != trace_entry_t::NOP && entry.type != trace_entry_t::FENCE) {
+            throw std::runtime_error(error("missing address"));
+        }
+
+        queues[cpu].push_back(entry);
+    }
+
+    std::string error(const char *what) const
+    {
+        std::ostringstream s;
+        s << "Trace stream line " << line_no << ": " << what;
+        return s.str();
+    }
+};
+
+#endif
@@ -0,0 +1,232 @@
+/*
+// File: wave_tracer.h
+//
+// Waveform tracing restricted to a window of cycles. The registered
+// signals are sampled on every clock edge and only changes are written, as
+// VCD text or in a compact binary format. The window either starts at a
+// given cycle or at a trigger, the first miss on a line, and ends after a
+// given number of cycles; outside of it tracing costs one comparison per
+// cycle. Times are in clock cycles.
+//
+// The binary format starts with the 8 bytes "SIMWAVE1", the number of
+// signals as a varint, and for every signal its width in bits and its name
+// as a varint length followed by the bytes. Then follows a change record
+// per value change: the cycles since the previous record, the signal index
+// and the new value, each as a varint (LEB128, 7 bits per byte, low bits
+// first, high bit set on all but the last byte). The first records of the
+// window carry the value of every signal.
+*/
+
+#ifndef WAVE_TRACER_H
+#define WAVE_TRACER_H
+
+#include <systemc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+class WaveTracer : public sc_module
+{
+public:
+    sc_in<bool> Port_CLK;
+
+    SC_HAS_PROCESS(WaveTracer);
+
+    /* Trace to path, in the binary format when binary is set. */
+    WaveTracer(sc_module_name name, const char *path, bool binary)
+        : sc_module(name), binary(binary), cycle(0), start(0), end(-1), started(false),
+          trigger_line(0), trigger_length(0), active(false), last_change(0)
+    {
+        file = fopen(path, binary ? "wb" : "w");
+        if (file == NULL) throw std::runtime_error(std::string("cannot create ") + path);
+
+        SC_METHOD(sample);
+        sensitive << Port_CLK.pos();
+        dont_initialize();
+    }
+
+    ~WaveTracer()
+    {
+        for (size_t i = 0; i < probes.size(); i++) delete probes[i];
+    }
+
+    /* Trace sig under name, width bits wide. All signals must be added
+       before the simulation starts. */
+    template<class T> void add(const std::string &name, const sc_signal<T> &sig, int width)
+    {
+        probes.push_back(new probe<T>(name, sig, width));
+    }
+
+    /* Trace length cycles from cycle first on, length < 0 till the end. */
+    void window(long first, long length)
+    {
+        start = first;
+        end = length < 0 ? -1 : first + length;
+    }
+
+    /* Trace length cycles from the first miss on line (address / line size). */
+    void trigger(uint64_t line, long length)
+    {
+        start = -1;
+        trigger_line = line;
+        trigger_length = length;
+    }
+
+    /* Called by the caches on every miss. */
+    void miss(uint64_t line)
+    {
+        if (start >= 0 || line != trigger_line) return;
+        window(cycle, trigger_length);
+    }
+
+    void close()
+    {
+        if (file == NULL) return;
+        fclose(file);
+        file = NULL;
+    }
+
+private:
+    /* A traced signal, read as an integer. */
+    class probe_base {
+    public:
+        std::string name;
+        int width;
+        uint64_t last;
+
+        probe_base(const std::string &name, int width) : name(name), width(width), last(0) {}
+        virtual ~probe_base() {}
+        virtual uint64_t read() const = 0;
+    };
+
+    template<class T> class probe : public probe_base {
+    public:
+        probe(const std::string &name, const sc_signal<T> &sig, int width) : probe_base(name, width), sig(sig) {}
+        virtual uint64_t read() const { return (uint64_t)sig.read(); }
+    private:
+        const sc_signal<T> &sig;
+    };
+
+    FILE *file;
+    bool binary;
+    std::vector<probe_base *> probes;
+
+    long cycle;
+    long start;             // -1 while waiting for the trigger
+    long end;               // -1 for the end of the run
+    bool started;           // the header has been written
+    uint64_t trigger_line;
+    long trigger_length;
+    bool active;
+    long last_change;
+
+    void sample()
+    {
+        cycle++;
+        if (file == NULL || start < 0 || cycle < start) return;
+
+        if (end >= 0 && cycle >= end)
+        {
+            if (active) close();
+            active = false;
+            return;
+        }
+
+        if (!started) header();
+
+        bool first = !active;
+        bool stamped = false;
+        active = true;
+
+        for (size_t i = 0; i < probes.size(); i++)
+        {
+            uint64_t value = probes[i]->read();
+            if (!first && value == probes[i]->last) continue;
+            probes[i]->last = value;
+
+            if (binary)
+            {
+                varint(cycle - last_change);
+                varint(i);
+                varint(value);
+                last_change = cycle;
+            }
+            else
+            {
+                if (!stamped) fprintf(file, "#%ld\n", cycle);
+                stamped = true;
+                vcd_value(i, value);
+            }
+        }
+    }
+
+    void header()
+    {
+        started = true;
+
+        if (binary)
+        {
+            fwrite("SIMWAVE1", 1, 8, file);
+            varint(probes.size());
+            for (size_t i = 0; i < probes.size(); i++)
+            {
+                varint(probes[i]->width);
+                varint(probes[i]->name.size());
+                fwrite(probes[i]->name.data(), 1, probes[i]->name.size(), file);
+            }
+            last_change = cycle;
+            return;
+        }
+
+        fprintf(file, "$comment one time unit is one clock cycle $end\n$timescale 1 ns $end\n$scope module %s $end\n", basename());
+        for (size_t i = 0; i < probes.size(); i++)
+        {
+            fprintf(file, "$var wire %d %s %s $end\n", probes[i]->width, vcd_id(i).c_str(), probes[i]->name.c_str());
+        }
+        fprintf(file, "$upscope $end\n$enddefinitions $end\n");
+    }
+
+    /* Short printable VCD identifier of signal i. */
+    static std::string vcd_id(size_t i)
+    {
+        std::string id;
+        do {
+            id += (char)('!' + i % 94);
+            i /= 94;
+        } while (i > 0);
+        return id;
+    }
+
+    void vcd_value(size_t i, uint64_t value)
+    {
+        if (probes[i]->width == 1)
+        {
+            fprintf(file, "%d%s\n", (int)(value & 1), vcd_id(i).c_str());
+            return;
+        }
+
+        char bits[65];
+        int n = 0;
+        for (int b = probes[i]->width - 1; b >= 0; b--)
+        {
+            if (n == 0 && b > 0 && !((value >> b) & 1)) continue;   // no leading zeros
+            bits[n++] = (value >> b) & 1 ? '1' : '0';
+        }
+        bits[n] = '\0';
+        fprintf(file, "b%s %s\n", bits, vcd_id(i).c_str());
+    }
+
+    void varint(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            fputc((int)(value & 0x7f) | 0x80, file);
+            value >>= 7;
+        }
+        fputc((int)value, file);
+    }
+};
+
+#endif
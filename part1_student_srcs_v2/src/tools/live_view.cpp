@@ -0,0 +1,107 @@
+/*
+// File: live_view.cpp
+//
+// Attaches to the live counters of a running simulation (task_3 --live)
+// and prints the counters and their rates per host second, every few
+// seconds, until the simulation ends.
+//
+// Usage: live_view [-i <seconds>] [-a] <segment> [pattern...]
+//
+// Only counters whose name contains one of the patterns are shown, and
+// only nonzero ones unless -a is given.
+*/
+
+#include "../common/live_counters.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool selected(const char *name, char **patterns, int n)
+{
+    if (n == 0) return true;
+    for (int i = 0; i < n; i++)
+    {
+        if (strstr(name, patterns[i]) != NULL) return true;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    double interval = 2.0;
+    bool all = false;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) interval = atof(argv[++i]);
+        else if (strcmp(argv[i], "-a") == 0) all = true;
+        else break;
+    }
+    if (i >= argc || interval <= 0)
+    {
+        fprintf(stderr, "usage: %s [-i <seconds>] [-a] <segment> [pattern...]\n", argv[0]);
+        return 1;
+    }
+
+    const live_header_t *h = LiveCounters::attach(argv[i]);
+    if (h == NULL)
+    {
+        fprintf(stderr, "no live counters in %s\n", argv[i]);
+        return 1;
+    }
+
+    char **patterns = argv + i + 1;
+    int num_patterns = argc - i - 1;
+    const char *names = LiveCounters::names(h);
+    const int64_t *values = LiveCounters::values(h);
+
+    // rates are over the intervals we watched, not the run so far
+    std::vector<int64_t> last(h->count);
+    for (uint32_t c = 0; c < h->count; c++) last[c] = __atomic_load_n(&values[c], __ATOMIC_RELAXED);
+    int64_t last_cycle = __atomic_load_n(&h->cycle, __ATOMIC_RELAXED);
+    double last_time = now();
+    bool running = true;
+
+    while (running)
+    {
+        struct timespec ts = { (time_t)interval, (long)((interval - (time_t)interval) * 1e9) };
+        nanosleep(&ts, NULL);
+
+        running = __atomic_load_n(&h->running, __ATOMIC_ACQUIRE);
+
+        double t = now();
+        double dt = t - last_time;
+        int64_t cycle = __atomic_load_n(&h->cycle, __ATOMIC_RELAXED);
+
+        printf("\n%s cycle %lld, %.0f cycles/s\n", running ? "running," : "finished,",
+               (long long)cycle, (cycle - last_cycle) / dt);
+        printf("    %-40s %15s %12s\n", "counter", "value", "per s");
+        for (uint32_t c = 0; c < h->count; c++)
+        {
+            int64_t v = __atomic_load_n(&values[c], __ATOMIC_RELAXED);
+            const char *name = names + c * LIVE_NAME_SIZE;
+
+            if ((all || v != 0) && selected(name, patterns, num_patterns))
+            {
+                printf("    %-40s %15lld %12.0f\n", name, (long long)v, (v - last[c]) / dt);
+            }
+            last[c] = v;
+        }
+        fflush(stdout);
+
+        last_cycle = cycle;
+        last_time = t;
+    }
+
+    return 0;
+}
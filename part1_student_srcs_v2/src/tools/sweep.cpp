@@ -0,0 +1,152 @@
+/*
+// File: sweep.cpp
+//
+// Parameter sweep over one trace with the functional model of
+// task_3/session.h. The trace is read once and every combination of the
+// given parameter values runs as its own session on a pool of threads.
+// Prints one CSV line per configuration.
+//
+// Usage: sweep [--threads <n>] [--protocol <list>] [--cache-size <list>]
+//              [--associativity <list>] [--line-size <list>]
+//              [--hit-latency <list>] [--mem-latency <list>]
+//              [--c2c-latency <list>] <trace|-> <num_cpus>
+//
+// A list is comma separated, e.g. --cache-size 8192,16384,32768. A
+// parameter that is not given keeps its task_3 default.
+*/
+
+#include "../task_3/session.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A swept parameter and its values. */
+typedef struct {
+    const char *option;
+    std::vector<std::string> values;
+} axis_t;
+
+static std::vector<std::string> split(const char *list)
+{
+    std::vector<std::string> items;
+    const char *p = list;
+
+    for (const char *comma; (comma = strchr(p, ',')) != NULL; p = comma + 1) items.push_back(std::string(p, comma));
+    items.push_back(p);
+    return items;
+}
+
+/* Set the parameter of option in config, false for an unknown option. */
+static bool set(SessionConfig &config, const char *option, const std::string &value)
+{
+    int n = atoi(value.c_str());
+
+    if (strcmp(option, "--protocol") == 0) config.protocol = value;
+    else if (strcmp(option, "--cache-size") == 0) config.cache_size = n;
+    else if (strcmp(option, "--associativity") == 0) config.associativity = n;
+    else if (strcmp(option, "--line-size") == 0) config.line_size = n;
+    else if (strcmp(option, "--hit-latency") == 0) config.hit_latency = n;
+    else if (strcmp(option, "--mem-latency") == 0) config.mem_latency = n;
+    else if (strcmp(option, "--c2c-latency") == 0) config.c2c_latency = n;
+    else return false;
+    return true;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<axis_t> axes;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int i = 1;
+
+    for (; i + 1 < argc && strncmp(argv[i], "--", 2) == 0; i += 2)
+    {
+        SessionConfig probe;
+        if (strcmp(argv[i], "--threads") == 0) threads = atoi(argv[i + 1]);
+        else if (set(probe, argv[i], "0"))
+        {
+            axis_t axis;
+            axis.option = argv[i];
+            axis.values = split(argv[i + 1]);
+            axes.push_back(axis);
+        }
+        else break;
+    }
+    if (i + 2 != argc || atoi(argv[i + 1]) <= 0 || threads <= 0)
+    {
+        fprintf(stderr, "usage: %s [--threads <n>] [--protocol <list>] [--cache-size <list>] [--associativity <list>]"
+                " [--line-size <list>] [--hit-latency <list>] [--mem-latency <list>] [--c2c-latency <list>]"
+                " <trace|-> <num_cpus>\n", argv[0]);
+        return 1;
+    }
+
+    // Every combination of the values, the last axis varying fastest
+    std::vector<SessionConfig> configs(1);
+    for (size_t a = 0; a < axes.size(); a++)
+    {
+        std::vector<SessionConfig> product;
+        for (size_t c = 0; c < configs.size(); c++)
+        {
+            for (size_t v = 0; v < axes[a].values.size(); v++)
+            {
+                SessionConfig config = configs[c];
+                set(config, axes[a].option, axes[a].values[v]);
+                product.push_back(config);
+            }
+        }
+        configs.swap(product);
+    }
+
+    try
+    {
+        double start = now();
+        LoadedTrace trace(argv[i], atoi(argv[i + 1]));
+        double loaded = now();
+
+        SweepPool pool(trace, configs);
+        pool.run(threads);
+        double done = now();
+
+        printf("protocol,cache_size,associativity,line_size,hit_latency,mem_latency,c2c_latency,"
+               "hits,misses,miss_rate,bus_reads,bus_readxs,bus_upgrades,bus_updates,transfers,memory_reads,writebacks,cycles,"
+               "error\n");
+        for (size_t c = 0; c < configs.size(); c++)
+        {
+            const SessionConfig &k = configs[c];
+            printf("%s,%d,%d,%d,%d,%d,%d,", k.protocol.c_str(), k.cache_size, k.associativity, k.line_size,
+                   k.hit_latency, k.mem_latency, k.c2c_latency);
+            if (!pool.error(c).empty())
+            {
+                // no results, the error quoted for CSV
+                std::string error = pool.error(c);
+                for (size_t q = 0; (q = error.find('"', q)) != std::string::npos; q += 2) error.insert(q, 1, '"');
+                printf(",,,,,,,,,,,\"%s\"\n", error.c_str());
+                continue;
+            }
+
+            const SessionStats &s = pool.result(c);
+            long accesses = s.hits() + s.misses();
+            printf("%ld,%ld,%f,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,\n", s.hits(), s.misses(),
+                   accesses ? (double)s.misses() / accesses : 0.0, s.reads, s.readxs, s.upgrades, s.updates,
+                   s.transfers, s.memory_reads, s.writebacks, s.cycles());
+        }
+
+        fprintf(stderr, "%ld trace entries loaded in %.2f s, %zu configurations in %.2f s on %d threads\n",
+                trace.size(), loaded - start, configs.size(), done - loaded, threads);
+    }
+    catch (std::exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}